@@ -0,0 +1,288 @@
+#include "simulation.h"
+#include <iostream>
+#include <cstdio>
+#include <string>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+
+// Headless Runner
+// Runs the simulation core without a window, as fast as it can, and reports its throughput and how busy each thread was. Used for capacity planning and for comparing builds:
+//   bouncyball_headless [--balls N] [--walls N] [--steps N] [--dt SECONDS] [--threads N] [--engine step|event] [--broadphase linear|grid|bvh] [--collisions on|off] [--simd scalar|avx2|avx512] [--lod on|off] [--seed N] [--scenario FILE] [--load FILE] [--import FILE] [--save FILE] [--record FILE] [--record-every N] [--record-events FILE]
+// The scenario is generated from the seed, so the same arguments always simulate the same scene. --scenario runs the scene of a scenario file instead, with the settings it makes taking precedence over the options. --load runs a saved snapshot instead, --import adds the balls of a CSV or binary particle file to the scene, and --save writes the final state to a snapshot. --record writes the particles of every N-th step (default 1) to a trajectory file while the run is timed, and --record-events writes the moments particles change course to an event file.
+
+// Radius and color of the generated and the imported balls
+const float ballRadius = 3.0f;
+const std::uint32_t ballColor = 0x6E6E6EFF; // slateBlue, as the sidebar forms use
+
+// Settings
+struct RunSettings {
+    size_t balls = 100000;
+    size_t walls = 200;
+    size_t steps = 1000;
+    float deltaTime = 1.0f / 120.0f;
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u) - 1; // The main thread is the remaining worker
+    bool eventEngine = false;
+    BroadphaseMode broadphase = BroadphaseMode::Grid;
+    bool ballCollisions = true;
+    SimdLevel simd = bestSimdLevel();
+    bool levelOfDetail = false;
+    unsigned int seed = 1;
+    std::string scenarioPath; // Scenario file to run instead of a generated scenario
+    std::string loadPath; // Snapshot to run instead of a generated scenario
+    std::string importPath; // Particle file whose balls are added to the scene
+    std::string savePath; // Snapshot to write after the run
+    std::string recordPath; // Trajectory file to record the run to
+    std::string eventPath; // Event file to record the run to
+    size_t recordInterval = 1;
+};
+
+// Function declarations
+bool parseArguments(int argc, char* argv[], RunSettings& settings);
+void buildScenario(Simulation& simulation, const RunSettings& settings);
+double kineticEnergy(const ParticleStore& particles);
+double positionChecksum(const ParticleStore& particles);
+
+// Main Function
+int main(int argc, char* argv[]) {
+    RunSettings settings;
+    if (!parseArguments(argc, argv, settings)) {
+        return 1;
+    }
+
+    Simulation simulation(sf::FloatRect(0, 0, SIMULATION_WIDTH, SIMULATION_HEIGHT), settings.threads);
+    simulation.setBroadphaseMode(settings.broadphase);
+    simulation.setEventEngine(settings.eventEngine);
+    simulation.ballCollisions = settings.ballCollisions;
+    simulation.simdLevel = settings.simd;
+    simulation.levelOfDetail = settings.levelOfDetail;
+    if (!settings.scenarioPath.empty()) {
+        auto loadStart = std::chrono::steady_clock::now();
+        Scenario scenario;
+        if (!readScenario(settings.scenarioPath, scenario)) {
+            return 1;
+        }
+        applyScenario(simulation, scenario);
+        simulation.applyCommands();
+        settings.deltaTime = scenario.stepLength.value_or(settings.deltaTime);
+        std::printf("loaded %s in %.1f ms\n", settings.scenarioPath.c_str(), std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count() * 1000.0);
+    }
+    else if (settings.loadPath.empty()) {
+        buildScenario(simulation, settings);
+        simulation.applyCommands();
+    }
+    else {
+        auto loadStart = std::chrono::steady_clock::now();
+        if (!loadSnapshot(simulation, settings.loadPath)) {
+            return 1;
+        }
+        std::printf("loaded %s in %.1f ms\n", settings.loadPath.c_str(), std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count() * 1000.0);
+    }
+
+    if (!settings.importPath.empty()) {
+        auto importStart = std::chrono::steady_clock::now();
+        size_t before = simulation.particles.size();
+        if (!importParticles(simulation, settings.importPath, ballRadius, ballColor)) {
+            return 1;
+        }
+        std::printf("imported %zu balls from %s in %.1f ms\n", simulation.particles.size() - before, settings.importPath.c_str(),
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - importStart).count() * 1000.0);
+    }
+
+    double startEnergy = kineticEnergy(simulation.particles);
+    if (!settings.recordPath.empty() && !simulation.recorder.start(settings.recordPath, settings.recordInterval)) {
+        return 1;
+    }
+    if (!settings.eventPath.empty() && !simulation.eventRecorder.start(settings.eventPath)) {
+        return 1;
+    }
+    simulation.threadPool.resetLoad();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t step = 0; step < settings.steps; ++step) {
+        simulation.step(settings.deltaTime);
+    }
+    simulation.flush();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (simulation.recorder.isRecording()) {
+        // Waiting for the writer to finish is not part of the timed run
+        bool written = simulation.recorder.stop();
+        std::printf("recorded %llu frames to %s, dropped %llu\n", static_cast<unsigned long long>(simulation.recorder.getRecordedFrames()), settings.recordPath.c_str(),
+            static_cast<unsigned long long>(simulation.recorder.getDroppedFrames()));
+        if (!written) {
+            return 1;
+        }
+    }
+    if (simulation.eventRecorder.isRecording()) {
+        bool written = simulation.eventRecorder.stop();
+        std::printf("recorded %llu events, %llu keyframes and %llu spawn records to %s, %.1f MB\n", static_cast<unsigned long long>(simulation.eventRecorder.getRecordedEvents()),
+            static_cast<unsigned long long>(simulation.eventRecorder.getRecordedKeyframes()), static_cast<unsigned long long>(simulation.eventRecorder.getRecordedSpawns()),
+            settings.eventPath.c_str(), simulation.eventRecorder.getWrittenBytes() / 1e6);
+        if (!written) {
+            return 1;
+        }
+    }
+
+    double particleSteps = static_cast<double>(simulation.particles.size()) * settings.steps;
+    std::printf("balls: %zu  walls: %zu  steps: %zu  threads: %zu\n", simulation.particles.size(), simulation.walls.size(), settings.steps, settings.threads + 1);
+    std::printf("engine: %s  broadphase: %s  ball collisions: %s  SIMD: %s  LOD: %s\n", simulation.eventEngine ? "event" : "step",
+        simulation.wallBroadphase.getModeName(), simulation.ballCollisions ? "on" : "off", getSimdLevelName(simulation.simdLevel), simulation.levelOfDetail ? "on" : "off");
+    std::printf("time: %.3f s  steps/sec: %.1f  ns/particle-step: %.2f\n", seconds, settings.steps / seconds,
+        particleSteps > 0 ? seconds * 1e9 / particleSteps : 0.0);
+    std::printf("kinetic energy: start %.6g  end %.6g  position checksum: %.6f\n", startEnergy, kineticEnergy(simulation.particles), positionChecksum(simulation.particles));
+
+    // Per-thread load: with even work all threads are busy for about the same time
+    std::vector<ThreadLoad> load = simulation.threadPool.getLoad();
+    for (size_t i = 0; i < load.size(); ++i) {
+        double total = load[i].busySeconds + load[i].idleSeconds;
+        std::printf("thread %zu: busy %.3f s (%.1f%%)  idle %.3f s  chunks: %llu  stolen: %llu\n", i, load[i].busySeconds,
+            total > 0 ? load[i].busySeconds * 100.0 / total : 0.0, load[i].idleSeconds,
+            static_cast<unsigned long long>(load[i].chunks), static_cast<unsigned long long>(load[i].steals));
+    }
+
+    if (!settings.savePath.empty()) {
+        auto saveStart = std::chrono::steady_clock::now();
+        if (!saveSnapshot(simulation, settings.savePath)) {
+            return 1;
+        }
+        std::printf("saved %s in %.1f ms\n", settings.savePath.c_str(), std::chrono::duration<double>(std::chrono::steady_clock::now() - saveStart).count() * 1000.0);
+    }
+    return 0;
+}
+
+// FUNCTIONS --------------------------------------------------------------
+
+// Reads the command line into settings. Prints the usage and returns false on an unknown option or a bad value.
+bool parseArguments(int argc, char* argv[], RunSettings& settings) {
+    const char* usage = "usage: bouncyball_headless [--balls N] [--walls N] [--steps N] [--dt SECONDS] [--threads N] [--engine step|event] [--broadphase linear|grid|bvh] [--collisions on|off] [--simd scalar|avx2|avx512] [--lod on|off] [--seed N] [--scenario FILE] [--load FILE] [--import FILE] [--save FILE] [--record FILE] [--record-every N] [--record-events FILE]";
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string option = argv[i];
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << option << std::endl << usage << std::endl;
+                return false;
+            }
+            std::string value = argv[++i];
+            if (option == "--balls") {
+                settings.balls = std::stoul(value);
+            }
+            else if (option == "--walls") {
+                settings.walls = std::stoul(value);
+            }
+            else if (option == "--steps") {
+                settings.steps = std::stoul(value);
+            }
+            else if (option == "--dt") {
+                settings.deltaTime = std::stof(value);
+            }
+            else if (option == "--threads") {
+                settings.threads = std::max(std::stoul(value), 1ul) - 1;
+            }
+            else if (option == "--engine" && (value == "step" || value == "event")) {
+                settings.eventEngine = value == "event";
+            }
+            else if (option == "--broadphase" && (value == "linear" || value == "grid" || value == "bvh")) {
+                settings.broadphase = value == "linear" ? BroadphaseMode::Linear : value == "grid" ? BroadphaseMode::Grid : BroadphaseMode::Bvh;
+            }
+            else if (option == "--collisions" && (value == "on" || value == "off")) {
+                settings.ballCollisions = value == "on";
+            }
+            else if (option == "--simd" && (value == "scalar" || value == "avx2" || value == "avx512")) {
+                SimdLevel simd = value == "scalar" ? SimdLevel::Scalar : value == "avx2" ? SimdLevel::Avx2 : SimdLevel::Avx512;
+                if (simd > bestSimdLevel()) {
+                    std::cerr << "This CPU does not support the " << value << " instructions" << std::endl;
+                    return false;
+                }
+                settings.simd = simd;
+            }
+            else if (option == "--lod" && (value == "on" || value == "off")) {
+                settings.levelOfDetail = value == "on";
+            }
+            else if (option == "--seed") {
+                settings.seed = std::stoul(value);
+            }
+            else if (option == "--scenario") {
+                settings.scenarioPath = value;
+            }
+            else if (option == "--load") {
+                settings.loadPath = value;
+            }
+            else if (option == "--import") {
+                settings.importPath = value;
+            }
+            else if (option == "--save") {
+                settings.savePath = value;
+            }
+            else if (option == "--record") {
+                settings.recordPath = value;
+            }
+            else if (option == "--record-every") {
+                settings.recordInterval = std::max(std::stoul(value), 1ul);
+            }
+            else if (option == "--record-events") {
+                settings.eventPath = value;
+            }
+            else {
+                std::cerr << "Invalid option: " << option << " " << value << std::endl << usage << std::endl;
+                return false;
+            }
+        }
+    }
+    catch (std::exception const& e) {
+        (void)e;
+        std::cerr << "Invalid number in the arguments" << std::endl << usage << std::endl;
+        return false;
+    }
+    if (settings.deltaTime <= 0) {
+        std::cerr << "The step length must be positive" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Posts randomly placed short walls and balls of radius 3 moving in random directions to the simulation, like a scene built from the sidebar forms.
+void buildScenario(Simulation& simulation, const RunSettings& settings) {
+    std::mt19937 random(settings.seed);
+    std::uniform_real_distribution<float> randomX(0.0f, static_cast<float>(SIMULATION_WIDTH));
+    std::uniform_real_distribution<float> randomY(0.0f, static_cast<float>(SIMULATION_HEIGHT));
+    std::uniform_real_distribution<float> randomAngle(0.0f, 360.0f);
+    std::uniform_real_distribution<float> randomLength(20.0f, 80.0f);
+    std::uniform_real_distribution<float> randomSpeed(50.0f, 500.0f);
+
+    std::vector<Wall> walls;
+    walls.reserve(settings.walls);
+    for (size_t i = 0; i < settings.walls; ++i) {
+        sf::Vector2f start(randomX(random), randomY(random));
+        float angle = randomAngle(random) * (pi / 180.0f);
+        float length = randomLength(random);
+        sf::Vector2f end(std::clamp(start.x + length * std::cos(angle), 0.0f, static_cast<float>(SIMULATION_WIDTH)),
+            std::clamp(start.y + length * std::sin(angle), 0.0f, static_cast<float>(SIMULATION_HEIGHT)));
+        walls.emplace_back(start, end);
+    }
+
+    std::uniform_real_distribution<float> spawnX(0.0f, SIMULATION_WIDTH - ballRadius * 2);
+    std::uniform_real_distribution<float> spawnY(ballRadius * 2, static_cast<float>(SIMULATION_HEIGHT));
+    std::vector<Ball> balls;
+    balls.reserve(settings.balls);
+    for (size_t i = 0; i < settings.balls; ++i) {
+        balls.emplace_back(spawnX(random), spawnY(random), ballRadius, ballColor, randomSpeed(random), randomAngle(random));
+    }
+    simulation.post(std::move(balls), std::move(walls));
+}
+
+// Sum of m * v^2 / 2 over all particles. Elastic collisions keep it constant, so a drift between runs points at a physics change.
+double kineticEnergy(const ParticleStore& particles) {
+    double energy = 0;
+    for (size_t i = 0; i < particles.size(); ++i) {
+        energy += 0.5 * particles.mass[i] * (static_cast<double>(particles.vx[i]) * particles.vx[i] + static_cast<double>(particles.vy[i]) * particles.vy[i]);
+    }
+    return energy;
+}
+
+// Sum of all positions, to compare the final state of two runs (e.g. with different kernels) at a glance.
+double positionChecksum(const ParticleStore& particles) {
+    double sum = 0;
+    for (size_t i = 0; i < particles.size(); ++i) {
+        sum += static_cast<double>(particles.x[i]) + particles.y[i];
+    }
+    return sum;
+}
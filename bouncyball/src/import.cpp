@@ -0,0 +1,205 @@
+#include "simulation.h"
+#include <iostream>
+#include <charconv>
+#include <cstring>
+#include <cctype>
+#include <bit>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+// Particle import: adds balls generated by other tools, from a CSV file or a raw binary file, straight to the particle store.
+// Both hold one record per ball: x, y, angle and speed, meaning the same as in the forms (x and y in pixels from the bottom left of the display area, angle in degrees, speed in pixels per second).
+// A CSV file (.csv) has one record per line, the values separated by commas; blank lines are skipped, and so is a first line that does not start with a number, such as a row of column names. Any other file is binary: the records packed one after another as four little-endian 32-bit floats, with no header.
+// The file is mapped into memory and split into pieces that are parsed in parallel on the thread pool. The store grows once for all records, and every piece writes its balls directly to their places in it, so no Ball objects are built or copied in between.
+
+static_assert(std::endian::native == std::endian::little, "binary imports are read as little-endian");
+
+const size_t importRecordSize = 4 * sizeof(float); // Of a binary record
+
+// Part of a CSV file parsed by one work item: whole lines from begin to end
+struct ImportPiece {
+    const char* begin;
+    const char* end;
+    size_t records = 0; // Lines holding a record
+    size_t lines = 0;
+    size_t firstRecord = 0; // Index of its first record among all records of the file
+    size_t firstLine = 0; // Line number of its first line
+    size_t badLine = 0; // Line number of the first invalid record, 0 if there is none
+};
+
+// Writes the ball of one record to particle i, with the values the Ball constructor would give it. Returns false if the values are not a valid ball: the position must lie in the display area and the speed must not be negative.
+static bool writeImportedBall(ParticleStore& particles, size_t i, float x, float y, float angle, float speed, float radius, std::uint32_t color) {
+    if (!(x >= 0 && y >= 0 && x <= SIMULATION_WIDTH && y <= SIMULATION_HEIGHT && speed >= 0 && std::isfinite(angle) && std::isfinite(speed))) {
+        return false;
+    }
+    float angleInRadians = angle * (pi / 180.0f);
+    particles.x[i] = x;
+    particles.y[i] = (SIMULATION_HEIGHT - y) - radius * 2;
+    particles.vx[i] = speed * std::cos(angleInRadians);
+    particles.vy[i] = -speed * std::sin(angleInRadians);
+    particles.radius[i] = radius;
+    particles.mass[i] = 1.0f;
+    particles.color[i] = color;
+    return true;
+}
+
+// Whether the line from begin to end holds nothing but blanks
+static bool isBlankLine(const char* begin, const char* end) {
+    return std::all_of(begin, end, [](char c) { return c == ' ' || c == '\t' || c == '\r'; });
+}
+
+// Reads the next value of a CSV record, skipping the blanks before it and the comma after it unless it is the last one.
+static bool readImportValue(const char*& position, const char* end, float& value, bool last) {
+    while (position < end && (*position == ' ' || *position == '\t')) {
+        ++position;
+    }
+    std::from_chars_result result = std::from_chars(position, end, value);
+    if (result.ec != std::errc()) {
+        return false;
+    }
+    position = result.ptr;
+    while (position < end && (*position == ' ' || *position == '\t' || (last && *position == '\r'))) {
+        ++position;
+    }
+    if (last) {
+        return position == end;
+    }
+    if (position == end || *position != ',') {
+        return false;
+    }
+    ++position;
+    return true;
+}
+
+// Parses the records of the piece into particles from its firstRecord on, stopping at the first invalid one.
+static void parseImportPiece(ImportPiece& piece, ParticleStore& particles, size_t at, float radius, std::uint32_t color) {
+    size_t record = at + piece.firstRecord;
+    size_t lineNumber = piece.firstLine;
+    for (const char* line = piece.begin; line < piece.end; ++lineNumber) {
+        const char* lineEnd = std::find(line, piece.end, '\n');
+        const char* position = line;
+        line = lineEnd < piece.end ? lineEnd + 1 : piece.end;
+        if (isBlankLine(position, lineEnd)) {
+            continue;
+        }
+        float x, y, angle, speed;
+        if (!readImportValue(position, lineEnd, x, false) || !readImportValue(position, lineEnd, y, false) || !readImportValue(position, lineEnd, angle, false)
+            || !readImportValue(position, lineEnd, speed, true) || !writeImportedBall(particles, record, x, y, angle, speed, radius, color)) {
+            piece.badLine = lineNumber;
+            return;
+        }
+        ++record;
+    }
+}
+
+// Adds the balls of every record in the CSV or binary file at path to the particles, with the given radius and color, in file order. Prints the reason and returns false, leaving the particles as they were, if the file is missing, empty or holds an invalid record.
+bool importParticles(Simulation& simulation, const std::string& path, float radius, std::uint32_t color) {
+    MappedFile file(path);
+    if (file.data == nullptr) {
+        std::cerr << "Cannot open import file " << path << ", or it is empty" << std::endl;
+        return false;
+    }
+#if !defined(_WIN32)
+    madvise(const_cast<char*>(file.data), file.size, MADV_WILLNEED); // Every byte is parsed, so start reading ahead right away
+#endif
+    ParticleStore& particles = simulation.particles;
+    ThreadPool& pool = simulation.threadPool;
+    size_t at = particles.size();
+    float maxRadius = particles.maxRadius;
+    bool csv = path.size() >= 4 && (path.compare(path.size() - 4, 4, ".csv") == 0 || path.compare(path.size() - 4, 4, ".CSV") == 0);
+
+    size_t count = 0;
+    std::string problem;
+    if (csv) {
+        // Skip a first line of column names
+        const char* begin = file.data;
+        const char* end = file.data + file.size;
+        size_t firstLine = 1;
+        const char* text = std::find_if(begin, end, [](char c) { return c != ' ' && c != '\t'; });
+        if (text < end && !(std::isdigit(static_cast<unsigned char>(*text)) || *text == '-' || *text == '+' || *text == '.' || *text == '\r' || *text == '\n')) {
+            const char* lineEnd = std::find(begin, end, '\n');
+            begin = lineEnd < end ? lineEnd + 1 : end;
+            firstLine = 2;
+        }
+
+        // Pieces of about importGrainSize bytes, each ending after a line break
+        std::vector<ImportPiece> pieces;
+        while (begin < end) {
+            const char* pieceEnd = begin + std::min<size_t>(importGrainSize, end - begin);
+            pieceEnd = std::find(pieceEnd, end, '\n');
+            pieceEnd = pieceEnd < end ? pieceEnd + 1 : end;
+            pieces.push_back({ begin, pieceEnd });
+            begin = pieceEnd;
+        }
+
+        // Count the records of every piece in parallel, then give each piece its place in the store and its first line number
+        pool.parallelFor(0, pieces.size(), 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                ImportPiece& piece = pieces[i];
+                for (const char* line = piece.begin; line < piece.end; ++piece.lines) {
+                    const char* lineEnd = std::find(line, piece.end, '\n');
+                    piece.records += isBlankLine(line, lineEnd) ? 0 : 1;
+                    line = lineEnd < piece.end ? lineEnd + 1 : piece.end;
+                }
+            }
+            });
+        for (ImportPiece& piece : pieces) {
+            piece.firstRecord = count;
+            piece.firstLine = firstLine;
+            count += piece.records;
+            firstLine += piece.lines;
+        }
+
+        particles.grow(count, radius);
+        pool.parallelFor(0, pieces.size(), 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                parseImportPiece(pieces[i], particles, at, radius, color);
+            }
+            });
+        for (const ImportPiece& piece : pieces) {
+            if (piece.badLine != 0) {
+                problem = path + ":" + std::to_string(piece.badLine) + ": invalid record, expected x, y, angle, speed within the display area";
+                break;
+            }
+        }
+    }
+    else {
+        if (file.size % importRecordSize != 0) {
+            std::cerr << "Import file " << path << " is not a whole number of " << importRecordSize << "-byte records" << std::endl;
+            return false;
+        }
+        count = file.size / importRecordSize;
+        particles.grow(count, radius);
+        std::atomic<size_t> badRecord{ count };
+        pool.parallelFor(0, count, particleChunkSize, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                float values[4];
+                std::memcpy(values, file.data + i * importRecordSize, sizeof(values));
+                if (!writeImportedBall(particles, at + i, values[0], values[1], values[2], values[3], radius, color)) {
+                    size_t bad = badRecord.load(std::memory_order_relaxed);
+                    while (i < bad && !badRecord.compare_exchange_weak(bad, i, std::memory_order_relaxed)) {
+                    }
+                    return;
+                }
+            }
+            });
+        if (badRecord.load() != count) {
+            problem = "Import file " + path + ": invalid record " + std::to_string(badRecord.load() + 1) + ", expected x, y, angle, speed within the display area";
+        }
+    }
+
+    if (!problem.empty()) {
+        // Drop the balls added for the file again
+        std::cerr << problem << std::endl;
+        particles.truncate(at);
+        particles.maxRadius = maxRadius;
+        return false;
+    }
+    if (count == 0) {
+        std::cerr << "Import file " << path << " holds no records" << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,625 @@
+#include "simulation.h"
+#include <limits>
+#include <bit>
+
+// Vectorized kernels with runtime dispatch: ball integration without walls, the swept-circle test of balls against walls, and spawning a batch of balls.
+
+// Integration kernels for balls that cannot hit a wall: move every ball by its velocity and bounce it off the edges of the boundary.
+// All kernels do the same float operations in the same order as updateBall (move the center, convert back to the top-left corner, compare with the same bounds), so without walls they match updateBall bit for bit. That holds as long as the compiler does not fuse a multiply and an add into an FMA in one path only; the CMake build turns that off for this file, and MSVC does not fuse intrinsics. Where it does happen, positions differ by at most one rounding step, below 1e-3 px anywhere in the simulated area.
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define KERNELS_SIMD 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#define TARGET_AVX512
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#endif
+
+// Limits of the top-left corner, computed per ball exactly as updateBall does
+struct Edges {
+    float left, right, top, bottom; // right = left + width, bottom = top + height
+};
+
+// Pointers to count consecutive particles that lie in one chunk of the particle arrays, so the kernels can use plain loads and stores
+struct ParticleRun {
+    float* x;
+    float* y;
+    float* vx;
+    float* vy;
+    float* radius;
+    float* mass;
+    std::uint32_t* color;
+    size_t count;
+    size_t index; // Of the first particle in the store
+};
+
+// The run of particles from index first to the end of its chunk or to last - 1, whichever comes first
+static ParticleRun particleRun(ParticleStore& particles, size_t first, size_t last) {
+    return { particles.x.pointer(first), particles.y.pointer(first), particles.vx.pointer(first), particles.vy.pointer(first),
+        particles.radius.pointer(first), particles.mass.pointer(first), particles.color.pointer(first), std::min(last, ChunkedArray<float>::chunkEnd(first)) - first, first };
+}
+
+// Reports the boundary bounce of particle i of the run, which happens where the kernel put it at the end of the step
+static void addBoundaryEvent(const ParticleRun& run, size_t i, std::vector<ParticleEvent>* events) {
+    events->push_back({ static_cast<uint32_t>(run.index + i), 0.0f, run.x[i], run.y[i], run.vx[i], run.vy[i] });
+}
+
+static void integrateScalar(const ParticleRun& run, size_t first, const Edges& edges, float deltaTime, std::vector<ParticleEvent>* events) {
+    float* x = run.x;
+    float* y = run.y;
+    float* vx = run.vx;
+    float* vy = run.vy;
+    const float* radius = run.radius;
+    for (size_t i = first; i < run.count; ++i) {
+        float r = radius[i];
+        float newX = (x[i] + r) + vx[i] * deltaTime - r;
+        float newY = (y[i] + r) + vy[i] * deltaTime - r;
+        float leftBound = edges.left + r;
+        float rightBound = edges.right - r * 2;
+        float topBound = edges.top + r;
+        float bottomBound = edges.bottom - r * 2;
+        bool bounced = false;
+        if (newX < leftBound || newX > rightBound) {
+            vx[i] = -vx[i];
+            newX = (newX < leftBound) ? leftBound : rightBound;
+            bounced = true;
+        }
+        if (newY < topBound || newY > bottomBound) {
+            vy[i] = -vy[i];
+            newY = (newY < topBound) ? topBound : bottomBound;
+            bounced = true;
+        }
+        x[i] = newX;
+        y[i] = newY;
+        if (bounced && events != nullptr) {
+            addBoundaryEvent(run, i, events);
+        }
+    }
+}
+
+#ifdef KERNELS_SIMD
+// 8 balls per iteration. Out-of-bounds lanes get their velocity sign flipped and are moved onto the bound they crossed, with masks instead of branches; only reporting them to events branches.
+TARGET_AVX2 static void integrateAvx2(const ParticleRun& run, size_t first, const Edges& edges, float deltaTime, std::vector<ParticleEvent>* events) {
+    float* x = run.x;
+    float* y = run.y;
+    float* vx = run.vx;
+    float* vy = run.vy;
+    const float* radius = run.radius;
+    const __m256 dt = _mm256_set1_ps(deltaTime);
+    const __m256 left = _mm256_set1_ps(edges.left);
+    const __m256 right = _mm256_set1_ps(edges.right);
+    const __m256 top = _mm256_set1_ps(edges.top);
+    const __m256 bottom = _mm256_set1_ps(edges.bottom);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+
+    size_t i = first;
+    for (; i + 8 <= run.count; i += 8) {
+        __m256 r = _mm256_loadu_ps(radius + i);
+        __m256 velocityX = _mm256_loadu_ps(vx + i);
+        __m256 velocityY = _mm256_loadu_ps(vy + i);
+        __m256 newX = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(x + i), r), _mm256_mul_ps(velocityX, dt)), r);
+        __m256 newY = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(y + i), r), _mm256_mul_ps(velocityY, dt)), r);
+        __m256 leftBound = _mm256_add_ps(left, r);
+        __m256 rightBound = _mm256_sub_ps(right, _mm256_mul_ps(r, two));
+        __m256 topBound = _mm256_add_ps(top, r);
+        __m256 bottomBound = _mm256_sub_ps(bottom, _mm256_mul_ps(r, two));
+
+        __m256 belowX = _mm256_cmp_ps(newX, leftBound, _CMP_LT_OQ);
+        __m256 outX = _mm256_or_ps(belowX, _mm256_cmp_ps(newX, rightBound, _CMP_GT_OQ));
+        __m256 belowY = _mm256_cmp_ps(newY, topBound, _CMP_LT_OQ);
+        __m256 outY = _mm256_or_ps(belowY, _mm256_cmp_ps(newY, bottomBound, _CMP_GT_OQ));
+
+        newX = _mm256_blendv_ps(newX, _mm256_blendv_ps(rightBound, leftBound, belowX), outX);
+        newY = _mm256_blendv_ps(newY, _mm256_blendv_ps(bottomBound, topBound, belowY), outY);
+        _mm256_storeu_ps(x + i, newX);
+        _mm256_storeu_ps(y + i, newY);
+        _mm256_storeu_ps(vx + i, _mm256_xor_ps(velocityX, _mm256_and_ps(outX, signBit)));
+        _mm256_storeu_ps(vy + i, _mm256_xor_ps(velocityY, _mm256_and_ps(outY, signBit)));
+        if (events != nullptr) {
+            for (unsigned int bounced = static_cast<unsigned int>(_mm256_movemask_ps(_mm256_or_ps(outX, outY))); bounced != 0; bounced &= bounced - 1) {
+                addBoundaryEvent(run, i + std::countr_zero(bounced), events);
+            }
+        }
+    }
+    integrateScalar(run, i, edges, deltaTime, events);
+}
+
+// 16 balls per iteration, same steps as integrateAvx2 using mask registers.
+TARGET_AVX512 static void integrateAvx512(const ParticleRun& run, size_t first, const Edges& edges, float deltaTime, std::vector<ParticleEvent>* events) {
+    float* x = run.x;
+    float* y = run.y;
+    float* vx = run.vx;
+    float* vy = run.vy;
+    const float* radius = run.radius;
+    const __m512 dt = _mm512_set1_ps(deltaTime);
+    const __m512 left = _mm512_set1_ps(edges.left);
+    const __m512 right = _mm512_set1_ps(edges.right);
+    const __m512 top = _mm512_set1_ps(edges.top);
+    const __m512 bottom = _mm512_set1_ps(edges.bottom);
+    const __m512 two = _mm512_set1_ps(2.0f);
+    const __m512i signBit = _mm512_set1_epi32(static_cast<int>(0x80000000u));
+
+    size_t i = first;
+    for (; i + 16 <= run.count; i += 16) {
+        __m512 r = _mm512_loadu_ps(radius + i);
+        __m512 velocityX = _mm512_loadu_ps(vx + i);
+        __m512 velocityY = _mm512_loadu_ps(vy + i);
+        __m512 newX = _mm512_sub_ps(_mm512_add_ps(_mm512_add_ps(_mm512_loadu_ps(x + i), r), _mm512_mul_ps(velocityX, dt)), r);
+        __m512 newY = _mm512_sub_ps(_mm512_add_ps(_mm512_add_ps(_mm512_loadu_ps(y + i), r), _mm512_mul_ps(velocityY, dt)), r);
+        __m512 leftBound = _mm512_add_ps(left, r);
+        __m512 rightBound = _mm512_sub_ps(right, _mm512_mul_ps(r, two));
+        __m512 topBound = _mm512_add_ps(top, r);
+        __m512 bottomBound = _mm512_sub_ps(bottom, _mm512_mul_ps(r, two));
+
+        __mmask16 belowX = _mm512_cmp_ps_mask(newX, leftBound, _CMP_LT_OQ);
+        __mmask16 outX = belowX | _mm512_cmp_ps_mask(newX, rightBound, _CMP_GT_OQ);
+        __mmask16 belowY = _mm512_cmp_ps_mask(newY, topBound, _CMP_LT_OQ);
+        __mmask16 outY = belowY | _mm512_cmp_ps_mask(newY, bottomBound, _CMP_GT_OQ);
+
+        newX = _mm512_mask_blend_ps(outX, newX, _mm512_mask_blend_ps(belowX, rightBound, leftBound));
+        newY = _mm512_mask_blend_ps(outY, newY, _mm512_mask_blend_ps(belowY, bottomBound, topBound));
+        _mm512_storeu_ps(x + i, newX);
+        _mm512_storeu_ps(y + i, newY);
+        _mm512_storeu_ps(vx + i, _mm512_castsi512_ps(_mm512_mask_xor_epi32(_mm512_castps_si512(velocityX), outX, _mm512_castps_si512(velocityX), signBit)));
+        _mm512_storeu_ps(vy + i, _mm512_castsi512_ps(_mm512_mask_xor_epi32(_mm512_castps_si512(velocityY), outY, _mm512_castps_si512(velocityY), signBit)));
+        if (events != nullptr) {
+            for (unsigned int bounced = static_cast<unsigned int>(outX | outY); bounced != 0; bounced &= bounced - 1) {
+                addBoundaryEvent(run, i + std::countr_zero(bounced), events);
+            }
+        }
+    }
+    integrateScalar(run, i, edges, deltaTime, events);
+}
+#endif
+
+// Wall kernels: the same capsule test as sweptCircleWallHit, but only the time of the first contact and the wall it belongs to are kept, and findWallHit computes the normal of that one wall afterwards. sweepWallBlock tests one ball against a block of candidate walls; sweepBallBlock tests a block of balls against every wall of the table, for the linear broadphase where all balls share the same candidates.
+// Divisions are replaced by multiplications with the reciprocals in the WallTable and the SweptBall. The one left, the time a flat side is reached, is only computed for lanes whose flat side test passes, which is checked with the division multiplied out.
+// The scalar kernel is the AVX2 lane arithmetic written out one lane at a time: the same float operations in the same order, so every SIMD level finds the same wall at the same time bit for bit, with the same caveat about FMA as the integration kernels. Where a multiply and an add get fused, a time can differ by a rounding step, about 1e-7 of the time, and runs drift apart from there.
+
+// Time the ball first touches wall w, within maxTime; infinity if it does not. 0 if it already touches the wall and moves into it.
+static float sweepWallLane(const WallTable& table, uint32_t w, const SweptBall& ball, float maxTime) {
+    const float infinity = std::numeric_limits<float>::infinity();
+    const float velocityX = ball.velocity.x;
+    const float velocityY = ball.velocity.y;
+
+    // Already touching: a hit at time 0 if moving into the wall, otherwise no hit at all
+    const bool hasLength = table.lengthSquared[w] > 0;
+    const float offsetX = ball.center.x - table.startX[w];
+    const float offsetY = ball.center.y - table.startY[w];
+    float closestAlong = (offsetX * table.edgeX[w] + offsetY * table.edgeY[w]) * table.inverseLengthSquared[w];
+    closestAlong = hasLength ? std::min(std::max(closestAlong, 0.0f), 1.0f) : 0.0f;
+    const float fromClosestX = ball.center.x - (table.startX[w] + table.edgeX[w] * closestAlong);
+    const float fromClosestY = ball.center.y - (table.startY[w] + table.edgeY[w] * closestAlong);
+    const float closestSquared = fromClosestX * fromClosestX + fromClosestY * fromClosestY;
+    if (closestSquared <= ball.reachSquared) {
+        bool intoOffset = closestSquared > 0 && velocityX * fromClosestX + velocityY * fromClosestY < 0;
+        bool intoNormal = closestSquared == 0 && velocityX * table.normalX[w] + velocityY * table.normalY[w] != 0;
+        return intoOffset || intoNormal ? 0.0f : infinity;
+    }
+
+    // Flat sides of the capsule. With the closing speed positive, t = excess / closingSpeed lies in [0, maxTime] and the contact point lies along the wall exactly when the tests below hold.
+    float laneTime = infinity;
+    const float distance = offsetX * table.normalX[w] + offsetY * table.normalY[w];
+    const float side = distance >= 0 ? 1.0f : -1.0f;
+    const float closingSpeed = -(velocityX * table.normalX[w] + velocityY * table.normalY[w]) * side;
+    const float excess = std::abs(distance) - ball.reach;
+    const float along = (offsetX * table.edgeX[w] + offsetY * table.edgeY[w]) * closingSpeed + excess * (velocityX * table.edgeX[w] + velocityY * table.edgeY[w]);
+    if (hasLength && closingSpeed > 0 && excess >= 0 && excess <= maxTime * closingSpeed && along >= 0 && along <= table.lengthSquared[w] * closingSpeed) {
+        laneTime = excess / closingSpeed;
+    }
+
+    // Rounded ends of the capsule
+    for (int end = 0; end < 2; ++end) {
+        float endOffsetX = ball.center.x - (end == 0 ? table.startX[w] : table.endX[w]);
+        float endOffsetY = ball.center.y - (end == 0 ? table.startY[w] : table.endY[w]);
+        float approach = endOffsetX * velocityX + endOffsetY * velocityY;
+        float endExcess = (endOffsetX * endOffsetX + endOffsetY * endOffsetY) - ball.reachSquared;
+        float discriminant = approach * approach - ball.speedSquared * endExcess;
+        if (ball.speedSquared != 0 && approach < 0 && discriminant >= 0) {
+            float endTime = (-approach - std::sqrt(discriminant)) * ball.inverseSpeedSquared;
+            if (endTime <= maxTime) {
+                laneTime = laneTime < endTime ? laneTime : endTime;
+            }
+        }
+    }
+    return laneTime;
+}
+
+static void sweepWallsScalar(const WallTable& table, const uint32_t* wallIndices, size_t count, const SweptBall& ball, float& time, uint32_t& hitWall, bool& hit) {
+    const float maxTime = time;
+    for (size_t lane = 0; lane < count; ++lane) {
+        float t = sweepWallLane(table, wallIndices[lane], ball, maxTime);
+        if (t != std::numeric_limits<float>::infinity() && (!hit || t < time)) {
+            time = t;
+            hitWall = wallIndices[lane];
+            hit = true;
+        }
+    }
+}
+
+static uint32_t sweepBallsScalar(const WallTable& table, const ParticleStore& particles, size_t first, size_t count, float maxTime) {
+    uint32_t touching = 0;
+    for (size_t lane = 0; lane < count; ++lane) {
+        size_t i = first + lane;
+        float radius = particles.radius[i];
+        SweptBall ball(sf::Vector2f(particles.x[i] + radius, particles.y[i] + radius), sf::Vector2f(particles.vx[i], particles.vy[i]), radius);
+        for (uint32_t w = 0; w < table.size(); ++w) {
+            if (sweepWallLane(table, w, ball, maxTime) != std::numeric_limits<float>::infinity()) {
+                touching |= 1u << lane;
+                break;
+            }
+        }
+    }
+    return touching;
+}
+
+#ifdef KERNELS_SIMD
+// Per-lane values of the AVX2 wall kernels: one wall and one ball for each of the 8 lanes
+struct WallLanes {
+    __m256 startX, startY, endX, endY, edgeX, edgeY, lengthSquared, inverseLengthSquared, normalX, normalY;
+};
+
+struct BallLanes {
+    __m256 centerX, centerY, velocityX, velocityY, reach, reachSquared, speedSquared, inverseSpeedSquared;
+};
+
+// sweepWallLane for 8 lanes at once. Every lane runs all three tests (touching, flat sides, rounded ends) and masks out the ones that do not apply.
+TARGET_AVX2 static __m256 sweepLanesAvx2(const WallLanes& wall, const BallLanes& ball, __m256 maxTime) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 infinity = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+
+    // Already touching: a hit at time 0 if moving into the wall, otherwise no hit at all
+    const __m256 hasLength = _mm256_cmp_ps(wall.lengthSquared, zero, _CMP_GT_OQ);
+    const __m256 offsetX = _mm256_sub_ps(ball.centerX, wall.startX);
+    const __m256 offsetY = _mm256_sub_ps(ball.centerY, wall.startY);
+    __m256 closestAlong = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(offsetX, wall.edgeX), _mm256_mul_ps(offsetY, wall.edgeY)), wall.inverseLengthSquared);
+    closestAlong = _mm256_and_ps(_mm256_min_ps(_mm256_max_ps(closestAlong, zero), one), hasLength);
+    const __m256 fromClosestX = _mm256_sub_ps(ball.centerX, _mm256_add_ps(wall.startX, _mm256_mul_ps(wall.edgeX, closestAlong)));
+    const __m256 fromClosestY = _mm256_sub_ps(ball.centerY, _mm256_add_ps(wall.startY, _mm256_mul_ps(wall.edgeY, closestAlong)));
+    const __m256 closestSquared = _mm256_add_ps(_mm256_mul_ps(fromClosestX, fromClosestX), _mm256_mul_ps(fromClosestY, fromClosestY));
+    const __m256 touching = _mm256_cmp_ps(closestSquared, ball.reachSquared, _CMP_LE_OQ);
+    const __m256 normalSpeed = _mm256_add_ps(_mm256_mul_ps(ball.velocityX, wall.normalX), _mm256_mul_ps(ball.velocityY, wall.normalY));
+    const __m256 intoOffset = _mm256_and_ps(_mm256_cmp_ps(closestSquared, zero, _CMP_GT_OQ),
+        _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(ball.velocityX, fromClosestX), _mm256_mul_ps(ball.velocityY, fromClosestY)), zero, _CMP_LT_OQ));
+    const __m256 intoNormal = _mm256_and_ps(_mm256_cmp_ps(closestSquared, zero, _CMP_EQ_OQ), _mm256_cmp_ps(normalSpeed, zero, _CMP_NEQ_OQ));
+    const __m256 touchHit = _mm256_and_ps(touching, _mm256_or_ps(intoOffset, intoNormal));
+
+    // Flat sides of the capsule, divided only if a lane passes
+    const __m256 distance = _mm256_add_ps(_mm256_mul_ps(offsetX, wall.normalX), _mm256_mul_ps(offsetY, wall.normalY));
+    const __m256 side = _mm256_blendv_ps(_mm256_set1_ps(-1.0f), one, _mm256_cmp_ps(distance, zero, _CMP_GE_OQ));
+    const __m256 closingSpeed = _mm256_mul_ps(_mm256_xor_ps(normalSpeed, signBit), side);
+    const __m256 excess = _mm256_sub_ps(_mm256_andnot_ps(signBit, distance), ball.reach);
+    const __m256 along = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(offsetX, wall.edgeX), _mm256_mul_ps(offsetY, wall.edgeY)), closingSpeed),
+        _mm256_mul_ps(excess, _mm256_add_ps(_mm256_mul_ps(ball.velocityX, wall.edgeX), _mm256_mul_ps(ball.velocityY, wall.edgeY))));
+    __m256 faceHit = _mm256_and_ps(hasLength, _mm256_cmp_ps(closingSpeed, zero, _CMP_GT_OQ));
+    faceHit = _mm256_and_ps(faceHit, _mm256_and_ps(_mm256_cmp_ps(excess, zero, _CMP_GE_OQ), _mm256_cmp_ps(excess, _mm256_mul_ps(maxTime, closingSpeed), _CMP_LE_OQ)));
+    faceHit = _mm256_and_ps(faceHit, _mm256_and_ps(_mm256_cmp_ps(along, zero, _CMP_GE_OQ), _mm256_cmp_ps(along, _mm256_mul_ps(wall.lengthSquared, closingSpeed), _CMP_LE_OQ)));
+    __m256 laneTime = infinity;
+    if (_mm256_movemask_ps(faceHit) != 0) {
+        laneTime = _mm256_blendv_ps(infinity, _mm256_div_ps(excess, closingSpeed), faceHit);
+    }
+
+    // Rounded ends of the capsule
+    const __m256 moving = _mm256_cmp_ps(ball.speedSquared, zero, _CMP_NEQ_OQ);
+    for (int end = 0; end < 2; ++end) {
+        __m256 endOffsetX = _mm256_sub_ps(ball.centerX, end == 0 ? wall.startX : wall.endX);
+        __m256 endOffsetY = _mm256_sub_ps(ball.centerY, end == 0 ? wall.startY : wall.endY);
+        __m256 approach = _mm256_add_ps(_mm256_mul_ps(endOffsetX, ball.velocityX), _mm256_mul_ps(endOffsetY, ball.velocityY));
+        __m256 endExcess = _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(endOffsetX, endOffsetX), _mm256_mul_ps(endOffsetY, endOffsetY)), ball.reachSquared);
+        __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(approach, approach), _mm256_mul_ps(ball.speedSquared, endExcess));
+        __m256 endTime = _mm256_mul_ps(_mm256_sub_ps(_mm256_xor_ps(approach, signBit), _mm256_sqrt_ps(discriminant)), ball.inverseSpeedSquared);
+        __m256 endHit = _mm256_and_ps(moving, _mm256_cmp_ps(approach, zero, _CMP_LT_OQ));
+        endHit = _mm256_and_ps(endHit, _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ), _mm256_cmp_ps(endTime, maxTime, _CMP_LE_OQ)));
+        laneTime = _mm256_min_ps(laneTime, _mm256_blendv_ps(infinity, endTime, endHit));
+    }
+
+    laneTime = _mm256_blendv_ps(laneTime, infinity, touching);
+    return _mm256_blendv_ps(laneTime, zero, touchHit);
+}
+
+// 8 walls per call, gathered from the wall table; lanes past count repeat the first wall.
+TARGET_AVX2 static void sweepWallsAvx2(const WallTable& table, const uint32_t* wallIndices, size_t count, const SweptBall& ball, float& time, uint32_t& hitWall, bool& hit) {
+    alignas(32) int32_t lanes[8];
+    for (size_t lane = 0; lane < 8; ++lane) {
+        lanes[lane] = static_cast<int32_t>(wallIndices[lane < count ? lane : 0]);
+    }
+    const __m256i index = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes));
+    WallLanes wall;
+    wall.startX = _mm256_i32gather_ps(table.startX.data(), index, 4);
+    wall.startY = _mm256_i32gather_ps(table.startY.data(), index, 4);
+    wall.endX = _mm256_i32gather_ps(table.endX.data(), index, 4);
+    wall.endY = _mm256_i32gather_ps(table.endY.data(), index, 4);
+    wall.edgeX = _mm256_i32gather_ps(table.edgeX.data(), index, 4);
+    wall.edgeY = _mm256_i32gather_ps(table.edgeY.data(), index, 4);
+    wall.lengthSquared = _mm256_i32gather_ps(table.lengthSquared.data(), index, 4);
+    wall.inverseLengthSquared = _mm256_i32gather_ps(table.inverseLengthSquared.data(), index, 4);
+    wall.normalX = _mm256_i32gather_ps(table.normalX.data(), index, 4);
+    wall.normalY = _mm256_i32gather_ps(table.normalY.data(), index, 4);
+
+    BallLanes balls;
+    balls.centerX = _mm256_set1_ps(ball.center.x);
+    balls.centerY = _mm256_set1_ps(ball.center.y);
+    balls.velocityX = _mm256_set1_ps(ball.velocity.x);
+    balls.velocityY = _mm256_set1_ps(ball.velocity.y);
+    balls.reach = _mm256_set1_ps(ball.reach);
+    balls.reachSquared = _mm256_set1_ps(ball.reachSquared);
+    balls.speedSquared = _mm256_set1_ps(ball.speedSquared);
+    balls.inverseSpeedSquared = _mm256_set1_ps(ball.inverseSpeedSquared);
+
+    alignas(32) float laneTimes[8];
+    _mm256_store_ps(laneTimes, sweepLanesAvx2(wall, balls, _mm256_set1_ps(time)));
+    for (size_t lane = 0; lane < count; ++lane) {
+        float t = laneTimes[lane];
+        if (t != std::numeric_limits<float>::infinity() && (!hit || t < time)) {
+            time = t;
+            hitWall = wallIndices[lane];
+            hit = true;
+        }
+    }
+}
+
+// 8 balls per call, each wall broadcast to all lanes; lanes past count repeat the first ball. Stops early once every ball touches a wall.
+TARGET_AVX2 static uint32_t sweepBallsAvx2(const WallTable& table, const ParticleStore& particles, size_t first, size_t count, float maxTime) {
+    alignas(32) float values[5][8];
+    for (size_t lane = 0; lane < 8; ++lane) {
+        size_t i = first + (lane < count ? lane : 0);
+        values[0][lane] = particles.x[i];
+        values[1][lane] = particles.y[i];
+        values[2][lane] = particles.vx[i];
+        values[3][lane] = particles.vy[i];
+        values[4][lane] = particles.radius[i];
+    }
+    const __m256 radius = _mm256_load_ps(values[4]);
+    BallLanes balls;
+    balls.centerX = _mm256_add_ps(_mm256_load_ps(values[0]), radius);
+    balls.centerY = _mm256_add_ps(_mm256_load_ps(values[1]), radius);
+    balls.velocityX = _mm256_load_ps(values[2]);
+    balls.velocityY = _mm256_load_ps(values[3]);
+    balls.reach = _mm256_add_ps(radius, _mm256_set1_ps(Wall::thickness / 2));
+    balls.reachSquared = _mm256_mul_ps(balls.reach, balls.reach);
+    balls.speedSquared = _mm256_add_ps(_mm256_mul_ps(balls.velocityX, balls.velocityX), _mm256_mul_ps(balls.velocityY, balls.velocityY));
+    const __m256 moving = _mm256_cmp_ps(balls.speedSquared, _mm256_setzero_ps(), _CMP_NEQ_OQ);
+    balls.inverseSpeedSquared = _mm256_and_ps(_mm256_div_ps(_mm256_set1_ps(1.0f), balls.speedSquared), moving);
+    const __m256 maxTimes = _mm256_set1_ps(maxTime);
+    const __m256 infinity = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+
+    const int allLanes = static_cast<int>((1u << count) - 1);
+    int touching = 0;
+    for (size_t w = 0; w < table.size() && (touching & allLanes) != allLanes; ++w) {
+        WallLanes wall;
+        wall.startX = _mm256_set1_ps(table.startX[w]);
+        wall.startY = _mm256_set1_ps(table.startY[w]);
+        wall.endX = _mm256_set1_ps(table.endX[w]);
+        wall.endY = _mm256_set1_ps(table.endY[w]);
+        wall.edgeX = _mm256_set1_ps(table.edgeX[w]);
+        wall.edgeY = _mm256_set1_ps(table.edgeY[w]);
+        wall.lengthSquared = _mm256_set1_ps(table.lengthSquared[w]);
+        wall.inverseLengthSquared = _mm256_set1_ps(table.inverseLengthSquared[w]);
+        wall.normalX = _mm256_set1_ps(table.normalX[w]);
+        wall.normalY = _mm256_set1_ps(table.normalY[w]);
+        touching |= _mm256_movemask_ps(_mm256_cmp_ps(sweepLanesAvx2(wall, balls, maxTimes), infinity, _CMP_NEQ_OQ));
+    }
+    return static_cast<uint32_t>(touching & allLanes);
+}
+#endif
+
+// Spawn kernels: write balls first, first + 1, ... of a batch to the particles of a run, with the same values the Ball constructor would give them.
+
+static float spawnParameter(const SpawnBatch& batch, size_t i) {
+    return batch.count > 1 ? (float)i / (float)(batch.count - 1) : 0.0f;
+}
+
+static void spawnScalar(const ParticleRun& run, size_t at, const SpawnBatch& batch, size_t first) {
+    for (size_t i = first; i < first + run.count - at; ++i) {
+        float t = spawnParameter(batch, i);
+        Ball ball(batch.startPosition.x + t * (batch.endPosition.x - batch.startPosition.x), batch.startPosition.y + t * (batch.endPosition.y - batch.startPosition.y),
+            batch.radius, batch.color, batch.startSpeed + t * (batch.endSpeed - batch.startSpeed), batch.startAngle + t * (batch.endAngle - batch.startAngle), batch.mass);
+        size_t j = at + (i - first);
+        run.x[j] = ball.x;
+        run.y[j] = ball.y;
+        run.vx[j] = ball.vx;
+        run.vy[j] = ball.vy;
+        run.radius[j] = ball.radius;
+        run.mass[j] = ball.mass;
+        run.color[j] = ball.color;
+    }
+}
+
+#ifdef KERNELS_SIMD
+// Sine and cosine of 8 angles in radians at once: reduces the angle to [-pi/4, pi/4] around the nearest multiple of pi/2 and evaluates the minimax polynomials of the Cephes library, accurate to about 1e-7 for the angles the forms produce.
+TARGET_AVX2 static void sinCosAvx2(__m256 angle, __m256& sine, __m256& cosine) {
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    __m256 sineSign = _mm256_and_ps(angle, signBit);
+    __m256 x = _mm256_andnot_ps(signBit, angle);
+
+    // Octant of the angle, rounded up to even so the remainder is centred on zero
+    __m256i octant = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(1.27323954473516f)));
+    octant = _mm256_and_si256(_mm256_add_epi32(octant, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+    __m256 octantF = _mm256_cvtepi32_ps(octant);
+
+    // Extended-precision subtraction of octant * pi/4
+    x = _mm256_sub_ps(x, _mm256_mul_ps(octantF, _mm256_set1_ps(0.78515625f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(octantF, _mm256_set1_ps(2.4187564849853515625e-4f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(octantF, _mm256_set1_ps(3.77489497744594108e-8f)));
+
+    __m256 swapSine = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(octant, _mm256_set1_epi32(4)), 29));
+    __m256 cosineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_andnot_si256(_mm256_sub_epi32(octant, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+    __m256 useSinePolynomial = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(octant, _mm256_set1_epi32(2)), _mm256_setzero_si256()));
+    sineSign = _mm256_xor_ps(sineSign, swapSine);
+
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 cosinePolynomial = _mm256_set1_ps(2.443315711809948e-5f);
+    cosinePolynomial = _mm256_add_ps(_mm256_mul_ps(cosinePolynomial, z), _mm256_set1_ps(-1.388731625493765e-3f));
+    cosinePolynomial = _mm256_add_ps(_mm256_mul_ps(cosinePolynomial, z), _mm256_set1_ps(4.166664568298827e-2f));
+    cosinePolynomial = _mm256_mul_ps(_mm256_mul_ps(cosinePolynomial, z), z);
+    cosinePolynomial = _mm256_add_ps(_mm256_sub_ps(cosinePolynomial, _mm256_mul_ps(z, _mm256_set1_ps(0.5f))), _mm256_set1_ps(1.0f));
+
+    __m256 sinePolynomial = _mm256_set1_ps(-1.9515295891e-4f);
+    sinePolynomial = _mm256_add_ps(_mm256_mul_ps(sinePolynomial, z), _mm256_set1_ps(8.3321608736e-3f));
+    sinePolynomial = _mm256_add_ps(_mm256_mul_ps(sinePolynomial, z), _mm256_set1_ps(-1.6666654611e-1f));
+    sinePolynomial = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(sinePolynomial, z), x), x);
+
+    sine = _mm256_xor_ps(_mm256_blendv_ps(cosinePolynomial, sinePolynomial, useSinePolynomial), sineSign);
+    cosine = _mm256_xor_ps(_mm256_blendv_ps(sinePolynomial, cosinePolynomial, useSinePolynomial), cosineSign);
+}
+
+// 8 balls per iteration; the interpolation and the conversions are the same operations as in spawnScalar, only the sine and cosine come from sinCosAvx2.
+TARGET_AVX2 static void spawnAvx2(const ParticleRun& run, const SpawnBatch& batch, size_t first) {
+    const __m256 span = _mm256_set1_ps(batch.count > 1 ? (float)(batch.count - 1) : 1.0f);
+    const __m256 startX = _mm256_set1_ps(batch.startPosition.x);
+    const __m256 deltaX = _mm256_set1_ps(batch.endPosition.x - batch.startPosition.x);
+    const __m256 startY = _mm256_set1_ps(batch.startPosition.y);
+    const __m256 deltaY = _mm256_set1_ps(batch.endPosition.y - batch.startPosition.y);
+    const __m256 startAngle = _mm256_set1_ps(batch.startAngle);
+    const __m256 deltaAngle = _mm256_set1_ps(batch.endAngle - batch.startAngle);
+    const __m256 startSpeed = _mm256_set1_ps(batch.startSpeed);
+    const __m256 deltaSpeed = _mm256_set1_ps(batch.endSpeed - batch.startSpeed);
+    const __m256 height = _mm256_set1_ps(static_cast<float>(SIMULATION_HEIGHT));
+    const __m256 diameter = _mm256_set1_ps(batch.radius * 2);
+    const __m256 toRadians = _mm256_set1_ps(pi / 180.0f);
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    size_t i = first;
+    size_t last = first + run.count;
+    for (; i + 8 <= last && i + 8 <= 0x7FFFFFFF; i += 8) {
+        __m256 t = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), laneOffsets)), span);
+        __m256 x = _mm256_add_ps(startX, _mm256_mul_ps(t, deltaX));
+        __m256 y = _mm256_add_ps(startY, _mm256_mul_ps(t, deltaY));
+        __m256 angle = _mm256_add_ps(startAngle, _mm256_mul_ps(t, deltaAngle));
+        __m256 speed = _mm256_add_ps(startSpeed, _mm256_mul_ps(t, deltaSpeed));
+        __m256 sine, cosine;
+        sinCosAvx2(_mm256_mul_ps(angle, toRadians), sine, cosine);
+
+        size_t j = i - first;
+        _mm256_storeu_ps(run.x + j, x);
+        _mm256_storeu_ps(run.y + j, _mm256_sub_ps(_mm256_sub_ps(height, y), diameter));
+        _mm256_storeu_ps(run.vx + j, _mm256_mul_ps(speed, cosine));
+        _mm256_storeu_ps(run.vy + j, _mm256_mul_ps(_mm256_xor_ps(speed, signBit), sine));
+    }
+    std::fill(run.radius, run.radius + (i - first), batch.radius);
+    std::fill(run.mass, run.mass + (i - first), batch.mass);
+    std::fill(run.color, run.color + (i - first), batch.color);
+    spawnScalar(run, i - first, batch, i);
+}
+#endif
+
+// Picks the widest kernel the CPU and the operating system support.
+SimdLevel bestSimdLevel() {
+#ifdef KERNELS_SIMD
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return SimdLevel::Scalar;
+    }
+    __cpuid(info, 1);
+    bool osSavesAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+    unsigned long long enabledState = osSavesAvx ? _xgetbv(0) : 0;
+    __cpuidex(info, 7, 0);
+    if ((info[1] & (1 << 16)) != 0 && (enabledState & 0xE6) == 0xE6) {
+        return SimdLevel::Avx512;
+    }
+    if ((info[1] & (1 << 5)) != 0 && (enabledState & 0x6) == 0x6) {
+        return SimdLevel::Avx2;
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::Avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::Avx2;
+    }
+#endif
+#endif
+    return SimdLevel::Scalar;
+}
+
+const char* getSimdLevelName(SimdLevel simd) {
+    switch (simd) {
+    case SimdLevel::Avx2:
+        return "AVX2";
+    case SimdLevel::Avx512:
+        return "AVX-512";
+    default:
+        return "Scalar";
+    }
+}
+
+// Moves balls first to last - 1 for deltaTime and bounces them off the boundary, ignoring walls. The kernels run once per chunk the range touches. With events, the balls that bounced are added to them.
+void integrateBalls(ParticleStore& particles, size_t first, size_t last, const sf::FloatRect& boundary, float deltaTime, SimdLevel simd, std::vector<ParticleEvent>* events) {
+    Edges edges{ boundary.left, boundary.left + boundary.width, boundary.top, boundary.top + boundary.height };
+    while (first < last) {
+        ParticleRun run = particleRun(particles, first, last);
+        switch (simd) {
+#ifdef KERNELS_SIMD
+        case SimdLevel::Avx512:
+            integrateAvx512(run, 0, edges, deltaTime, events);
+            break;
+        case SimdLevel::Avx2:
+            integrateAvx2(run, 0, edges, deltaTime, events);
+            break;
+#endif
+        default:
+            integrateScalar(run, 0, edges, deltaTime, events);
+            break;
+        }
+        first += run.count;
+    }
+}
+
+// Generates balls first to last - 1 of the batch into particles at, at + 1, ..., which must already exist. The AVX2 kernel also serves the AVX-512 level.
+void spawnBalls(ParticleStore& particles, size_t at, const SpawnBatch& batch, size_t first, size_t last, SimdLevel simd) {
+    while (first < last) {
+        ParticleRun run = particleRun(particles, at, at + (last - first));
+        switch (simd) {
+#ifdef KERNELS_SIMD
+        case SimdLevel::Avx512:
+        case SimdLevel::Avx2:
+            spawnAvx2(run, batch, first);
+            break;
+#endif
+        default:
+            spawnScalar(run, 0, batch, first);
+            break;
+        }
+        at += run.count;
+        first += run.count;
+    }
+}
+
+// Tests the ball against the count (at most wallBlockSize) walls in wallIndices and updates time, hitWall and hit when one of them is touched before time. The AVX2 kernel also serves the AVX-512 level, as a block holds only 8 walls.
+void sweepWallBlock(const WallTable& table, const uint32_t* wallIndices, size_t count, const SweptBall& ball, SimdLevel simd, float& time, uint32_t& hitWall, bool& hit) {
+    switch (simd) {
+#ifdef KERNELS_SIMD
+    case SimdLevel::Avx512:
+    case SimdLevel::Avx2:
+        sweepWallsAvx2(table, wallIndices, count, ball, time, hitWall, hit);
+        break;
+#endif
+    default:
+        sweepWallsScalar(table, wallIndices, count, ball, time, hitWall, hit);
+        break;
+    }
+}
+
+// Tests balls first to first + count - 1 (count at most wallBlockSize, all in one chunk) against every wall of the table. Returns a bit per ball, the lowest for the first, set if the ball touches a wall within maxTime. The AVX2 kernel also serves the AVX-512 level.
+uint32_t sweepBallBlock(const WallTable& table, const ParticleStore& particles, size_t first, size_t count, float maxTime, SimdLevel simd) {
+    switch (simd) {
+#ifdef KERNELS_SIMD
+    case SimdLevel::Avx512:
+    case SimdLevel::Avx2:
+        return sweepBallsAvx2(table, particles, first, count, maxTime);
+#endif
+    default:
+        return sweepBallsScalar(table, particles, first, count, maxTime);
+    }
+}
@@ -1,17 +1,12 @@
+#include "simulation.h"
 #include <SFML/Graphics.hpp>
 #include <iostream>
-#include <vector>
-#include <cmath>
-#include <thread>
-#include <mutex>
-#include <future>
-
-#define M_PI 3.14159265358979323846
+#include <cstdio>
 
 // Constants for the GUI layout
 const unsigned int SIDEBAR_WIDTH = 320;
-const unsigned int WINDOW_WIDTH = 1280 + SIDEBAR_WIDTH;
-const unsigned int WINDOW_HEIGHT = 720;
+const unsigned int WINDOW_WIDTH = SIMULATION_WIDTH + SIDEBAR_WIDTH;
+const unsigned int WINDOW_HEIGHT = SIMULATION_HEIGHT;
 const unsigned int INPUT_HEIGHT = 30;
 
 // Color for display
@@ -22,43 +17,15 @@ const sf::Color slateBlue(110, 110, 110);
 const sf::Color cornFlower(160, 207, 234);
 
 // Class declarations
-class Wall;
-class Ball;
+class ParticleRenderer;
 class RadioButton;
 class InputBox;
 
 // Function declarations 
 sf::RectangleShape createTextButton(float x, float y, float width, float height, const std::string& textContent, sf::Font& font, std::vector<sf::Text>& buttonTexts);
 sf::Text createLabel(const std::string& content, sf::Font& font, unsigned int size, float x, float y);
-sf::Vector2f reflect(const sf::Vector2f& velocity, const sf::Vector2f& normal);
 sf::Text createInputLabel(const std::string& content, sf::Font& font, unsigned int size, float x, float y, float boxHeight);
-sf::Vector2f getWallCollision(const Wall& wall);
-
-// Wall Class
-// Represents a wall in the simulation, defined by start and end points. It calculates its own shape, size, and orientation based on these points and can draw itself on a render window.
-class Wall {
-public:
-    sf::Vector2f start;
-    sf::Vector2f end;
-    sf::RectangleShape shape;
-
-    Wall(sf::Vector2f start, sf::Vector2f end) : start(start), end(end) {
-        sf::Vector2f direction = end - start;
-        float length = std::sqrt(direction.x * direction.x + direction.y * direction.y);
-        shape.setSize(sf::Vector2f(length, 2)); // The wall has a thickness of 2 units
-        shape.setOrigin(0, 1); // Origin is at the top left corner
-        shape.setPosition(start);
-
-        // Calculation for the angle to rotate the wall
-        float angle = std::atan2(direction.y, direction.x) * 180 / (float)M_PI;
-        shape.setRotation(angle);
-        shape.setFillColor(slateBlue);
-    }
-
-    void draw(sf::RenderWindow& window) const {
-        window.draw(shape);
-    }
-};
+sf::RectangleShape createWallShape(const Wall& wall);
 
 // Radio Button Class
 // Represents a radio button with an outer circle, an inner circle, and a label. It can draw itself, handle selection/deselection, and detect if it contains a given point (for mouse interaction).
@@ -116,104 +83,91 @@ public:
     }
 };
 
-// Ball Class
-// Represents a moving ball in the simulation. It keeps track of its position, velocity, and can calculate its new position based on collisions with boundaries and walls. It can also draw itself and check for line intersections (for collision detection).
-class Ball {
-public:
-    sf::CircleShape shape;
-    float vx, vy;
-
-    Ball(float x, float y, float radius, sf::Color color, float speed, float angleInDegrees)
-        : shape(radius) {
-        float invertedY = WINDOW_HEIGHT - y;
-
-        shape.setPosition(x, invertedY - radius * 2); // Adjust for radius to ensure the ball spawns from the correct location
-        shape.setFillColor(color);
-
-        // Convert angle from degrees to radians
-        float angleInRadians = angleInDegrees * ((float)M_PI / 180.0f);
-
-        // Calculate velocity components based on speed and angle
-        vx = speed * std::cos(angleInRadians);
-        vy = -speed * std::sin(angleInRadians);
-    }
-
-    void draw(sf::RenderWindow& window) const {
-        window.draw(shape);
-    }
-
-    bool lineIntersect(sf::Vector2f p1, sf::Vector2f p2, sf::Vector2f p3, sf::Vector2f p4, sf::Vector2f* intersection = nullptr) {
-        float s1_x = p2.x - p1.x;
-        float s1_y = p2.y - p1.y;
-        float s2_x = p4.x - p3.x;
-        float s2_y = p4.y - p3.y;
-
-        float s, t;
-        s = (-s1_y * (p1.x - p3.x) + s1_x * (p1.y - p3.y)) / (-s2_x * s1_y + s1_x * s2_y);
-        t = (s2_x * (p1.y - p3.y) - s2_y * (p1.x - p3.x)) / (-s2_x * s1_y + s1_x * s2_y);
+// Render Quality
+// How particles are drawn: as smooth circles (a textured quad each) or as single points, which is much cheaper but loses the shape.
+enum class RenderQuality {
+    Circles,
+    Points
+};
 
-        if (s >= 0 && s <= 1 && t >= 0 && t <= 1) {
-            if (intersection != nullptr) {
-                intersection->x = p1.x + (t * s1_x);
-                intersection->y = p1.y + (t * s1_y);
+// Particle Renderer Class
+// Draws every particle with a single draw call. The vertices for all particles are written into one sf::VertexArray, split over the thread pool, and drawn at once, instead of drawing one sf::CircleShape per particle. In Circles quality each particle is a quad (two triangles) mapped to a shared antialiased circle texture and tinted with the particle's color; in Points quality it is one vertex.
+// createTexture() needs an OpenGL context, so it must be called after the window is created.
+class ParticleRenderer {
+public:
+    RenderQuality quality;
+
+    explicit ParticleRenderer(RenderQuality quality) : quality(quality) {}
+
+    // Renders the circle texture all particles share: white, with alpha fading out over the last pixel of the edge.
+    bool createTexture() {
+        sf::Image image;
+        image.create(textureSize, textureSize, sf::Color::Transparent);
+        const float center = textureSize / 2.0f;
+        for (unsigned int y = 0; y < textureSize; ++y) {
+            for (unsigned int x = 0; x < textureSize; ++x) {
+                float dx = x + 0.5f - center;
+                float dy = y + 0.5f - center;
+                float coverage = std::clamp(center - std::sqrt(dx * dx + dy * dy) + 0.5f, 0.0f, 1.0f);
+                image.setPixel(x, y, sf::Color(255, 255, 255, static_cast<sf::Uint8>(coverage * 255)));
             }
-            return true;
         }
-
-        return false;
+        if (!texture.loadFromImage(image)) {
+            return false;
+        }
+        texture.setSmooth(true);
+        return true;
     }
 
-    // Function to update the ball position and check for boundary collisions
-    void update(const sf::RectangleShape& boundary, const std::vector<Wall>& walls, float deltaTime) {
-
-        //Calculate the trajectory line of the ball for this frame
-        sf::Vector2f startPosition = shape.getPosition();
-        sf::Vector2f endPosition = startPosition + sf::Vector2f(vx * deltaTime, vy * deltaTime);
-
-        // Check boundary collision with adjusted ball radius
-        float leftBound = boundary.getPosition().x + shape.getRadius();
-        float rightBound = boundary.getPosition().x + boundary.getSize().x - shape.getRadius() * 2;
-        float topBound = boundary.getPosition().y + shape.getRadius();
-        float bottomBound = boundary.getPosition().y + boundary.getSize().y - shape.getRadius() * 2;
-
-        if (endPosition.x < leftBound || endPosition.x > rightBound) {
-            vx = -vx; // Reverse horizontal velocity
-            endPosition.x = (endPosition.x < leftBound) ? leftBound : rightBound;
-        }
+    const char* getQualityName() const {
+        return quality == RenderQuality::Points ? "Points" : "Circles";
+    }
 
-        if (endPosition.y < topBound || endPosition.y > bottomBound) {
-            vy = -vy; // Reverse vertical velocity
-            endPosition.y = (endPosition.y < topBound) ? topBound : bottomBound;
+    void draw(sf::RenderWindow& window, const ParticleStore& particles, ThreadPool& pool, size_t grainSize) {
+        const size_t count = particles.size();
+        if (quality == RenderQuality::Points) {
+            vertices.setPrimitiveType(sf::Points);
+            vertices.resize(count);
+            pool.parallelFor(0, count, grainSize, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i) {
+                    float radius = particles.radius[i];
+                    vertices[i] = sf::Vertex(sf::Vector2f(particles.x[i] + radius, particles.y[i] + radius), sf::Color(particles.color[i]));
+                }
+                });
+            window.draw(vertices);
+            return;
         }
 
-        // Wall collision handling
-        bool collisionDetected = false;
-        sf::Vector2f collisionPoint;
-        sf::Vector2f wallCollision;
-        for (const auto& wall : walls) {
-            if (lineIntersect(startPosition, endPosition, wall.start, wall.end, &collisionPoint)) {
-                collisionDetected = true;
-                wallCollision = getWallCollision(wall);
-                break;
+        vertices.setPrimitiveType(sf::Triangles);
+        vertices.resize(count * 6);
+        const float size = static_cast<float>(textureSize);
+        pool.parallelFor(0, count, grainSize, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                float left = particles.x[i];
+                float top = particles.y[i];
+                float diameter = particles.radius[i] * 2;
+                sf::Color color(particles.color[i]);
+                sf::Vertex topLeft(sf::Vector2f(left, top), color, sf::Vector2f(0, 0));
+                sf::Vertex topRight(sf::Vector2f(left + diameter, top), color, sf::Vector2f(size, 0));
+                sf::Vertex bottomRight(sf::Vector2f(left + diameter, top + diameter), color, sf::Vector2f(size, size));
+                sf::Vertex bottomLeft(sf::Vector2f(left, top + diameter), color, sf::Vector2f(0, size));
+                sf::Vertex* quad = &vertices[i * 6];
+                quad[0] = topLeft;
+                quad[1] = topRight;
+                quad[2] = bottomRight;
+                quad[3] = topLeft;
+                quad[4] = bottomRight;
+                quad[5] = bottomLeft;
             }
-        }
-
-        if (collisionDetected) {
-            // Reflect the velocity vector off the wall's normal vector
-            sf::Vector2f incomingVelocity(vx, vy);
-            sf::Vector2f reflectedVelocity = reflect(incomingVelocity, wallCollision);
-            vx = reflectedVelocity.x;
-            vy = reflectedVelocity.y;
-
-            // Adjust the ball's position to the point of collision plus a bit back,
-            // so it won't collide again in the next frame because of numerical errors
-            sf::Vector2f newPosition = collisionPoint - (incomingVelocity * deltaTime * 0.5f);
-            shape.setPosition(newPosition);
-        }
-        else {
-            shape.setPosition(endPosition); // Move the ball to its new position
-        }
+            });
+        window.draw(vertices, sf::RenderStates(&texture));
     }
+
+private:
+    static constexpr unsigned int textureSize = 64; // Side of the circle texture; large enough to stay smooth for big balls
+
+    sf::Texture texture;
+    sf::VertexArray vertices;
 };
 
 // Input Box Class
@@ -300,30 +254,57 @@ public:
 
 // Functions
 void updateInputBoxes(std::vector<InputBox>& inputBoxes, sf::Font& font, float startY, int form);
-void updateBallsInParallel(std::vector<Ball>& balls, const sf::RectangleShape& boundary, const std::vector<Wall>& walls, float deltaTime);
-void addBallSafely(const Ball& ball);
-void updateBalls(float deltaTime, const sf::RectangleShape& displayArea, const std::vector<Wall>& walls, int currentFrame);
-void drawBalls(sf::RenderWindow& window);
-void triggerErrorMessage();
+void triggerErrorMessage(const std::string& message = "Input Error");
+bool openScenario(const std::string& path);
 
 // Variables
-std::vector<Wall> walls;
-std::vector<Ball> balls;
-std::mutex vectorMutex; // Mutex to protect shared vectors
-int updateInterval = 5; // Update every 5 frames
+const size_t workerThreadCount = std::max(std::thread::hardware_concurrency(), 1u) - 1; // The main thread is the remaining worker
+Simulation simulation(sf::FloatRect(0, 0, SIMULATION_WIDTH, SIMULATION_HEIGHT), workerThreadCount);
+std::vector<sf::RectangleShape> wallShapes; // One shape per wall in simulation.walls, in the same order
+ParticleRenderer particleRenderer(RenderQuality::Circles);
+const float eraserSize = 60.0f; // Side of the square a right click clears of balls
+const std::string snapshotPath = "scene.snapshot"; // Where S saves the scene and O restores it from, relative to the working directory
+const std::string importPath = "particles.csv"; // The particle file I adds the balls of
+std::string scenarioPath = "scenario.txt"; // The scenario file N loads; the first command-line argument replaces it and is loaded at startup
+const std::string trajectoryPath = "recording.trajectory"; // Where T records the particles to
+const size_t recordInterval = 2; // Steps per recorded frame: 60 frames per second at the default fixed step
+const std::string eventPath = "recording.events"; // Where Shift+T records the moments the particles change course to
+std::string replayPath = trajectoryPath; // The recording P plays: the one started last
+TrajectoryPlayer player; // Plays back the recording in replayPath
+bool replaying = false; // Show the recording instead of the live simulation, which is paused meanwhile
+bool replayPaused = false;
+bool scrubbing = false; // The left mouse button is held on the replay bar
+double replayTime = 0; // Simulated time of the recording to show
+double replaySpeed = 1.0; // Simulated seconds played per real second
+const double minReplaySpeed = 1.0 / 16.0;
+const double maxReplaySpeed = 64.0;
+const float replaySkip = 1.0f; // Seconds the arrow keys jump in the recording
+const size_t renderGrainSize = 8192; // Balls per parallel work item when filling the vertex array
+bool fixedStep = true; // Advance physics in fixed steps instead of by the frame time
+float fixedTimeStep = 1.0f / 120.0f; // Length of one fixed physics step in seconds
+int maxStepsPerFrame = 8; // Steps beyond this in one frame are dropped so a slow frame cannot snowball
+const float minFixedTimeStep = 1.0f / 960.0f;
+const float maxFixedTimeStep = 1.0f / 15.0f;
 sf::Text errorMessage;
 bool showError = false;
 sf::Clock errorClock; // Tracks how long the error message has been displayed
 const float errorDisplayTime = 3.0f; // Error message display time in seconds
 
 // Main Function
-int main() {
+int main(int argc, char* argv[]) {
 
     unsigned int frameCount = 0;
     sf::Clock fpsClock;
     sf::Clock displayClock; 
     sf::Clock clock;
     sf::Text fpsText;
+    sf::Text statsText;
+    sf::Text spawnText;
+    sf::Clock physicsClock;
+    float physicsSeconds = 0; // Time spent in the physics step since the last stats update
+    float accumulator = 0; // Frame time not yet simulated in fixed-step mode
+    unsigned int physicsSteps = 0; // Physics steps since the last stats update
+    unsigned long long droppedSteps = 0; // Fixed steps skipped because the frame fell too far behind
 
     sf::Font font;
     std::vector<RadioButton> radioButtons;
@@ -353,6 +334,11 @@ int main() {
         return -1;
     }
 
+    if (!particleRenderer.createTexture()) {
+        std::cerr << "Failed to create the particle texture!" << std::endl;
+        return -1;
+    }
+
     // Initialize text labels for the sections
     sf::Text ballsTitle = createLabel("Particles", font, 20, WINDOW_WIDTH - SIDEBAR_WIDTH + 10, 20);
     sf::Text wallsTitle = createLabel("Walls", font, 20, WINDOW_WIDTH - SIDEBAR_WIDTH + 10, 360 + 70);
@@ -381,7 +367,33 @@ int main() {
     fpsText.setFont(font);
     fpsText.setCharacterSize(20);
     fpsText.setFillColor(slateBlue);
-    fpsText.setPosition(WINDOW_WIDTH - 210, WINDOW_HEIGHT - 50); // Position it at the top-right corner
+    fpsText.setPosition(WINDOW_WIDTH - 90, WINDOW_HEIGHT - 50); // Position it at the bottom-right corner
+
+    // Initialize the physics stats text (wall broadphase mode and time per physics step)
+    statsText.setFont(font);
+    statsText.setCharacterSize(14);
+    statsText.setFillColor(slateBlue);
+    statsText.setPosition(WINDOW_WIDTH - SIDEBAR_WIDTH + 10, WINDOW_HEIGHT - 114);
+
+    // Initialize the spawn progress text, shown above the stats while a batch is being spawned
+    spawnText.setFont(font);
+    spawnText.setCharacterSize(14);
+    spawnText.setFillColor(slateBlue);
+    spawnText.setPosition(WINDOW_WIDTH - SIDEBAR_WIDTH + 10, WINDOW_HEIGHT - 136);
+
+    // Initialize the replay bar along the bottom of the display area and the replay status above it; clicking or dragging on the bar jumps in the recording
+    sf::RectangleShape replayBar(sf::Vector2f(SIMULATION_WIDTH - 20.0f, 6.0f));
+    replayBar.setPosition(10, WINDOW_HEIGHT - 16);
+    replayBar.setFillColor(flashWhite);
+    sf::RectangleShape replayProgress(sf::Vector2f(0, 6.0f));
+    replayProgress.setPosition(10, WINDOW_HEIGHT - 16);
+    replayProgress.setFillColor(slateBlue);
+    sf::FloatRect replayBarArea(0, WINDOW_HEIGHT - 28.0f, static_cast<float>(SIMULATION_WIDTH), 28.0f); // Taller than the bar so it is easy to hit
+    sf::Text replayText;
+    replayText.setFont(font);
+    replayText.setCharacterSize(14);
+    replayText.setFillColor(slateBlue);
+    replayText.setPosition(10, WINDOW_HEIGHT - 38);
     int activeForm = -1;
     float deltaTime = clock.restart().asSeconds();
 
@@ -392,6 +404,14 @@ int main() {
     errorMessage.setFillColor(sf::Color::Red);
     errorMessage.setPosition(WINDOW_WIDTH - SIDEBAR_WIDTH - errorMessage.getLocalBounds().width - 10, 10);
 
+    // Start with the scenario given on the command line
+    if (argc > 1) {
+        scenarioPath = argv[1];
+        if (!openScenario(scenarioPath)) {
+            triggerErrorMessage("Cannot load " + scenarioPath);
+        }
+    }
+
     // Main event loop
     while (window.isOpen()) {
         sf::Event event;
@@ -404,6 +424,176 @@ int main() {
                 window.close();
             }
 
+            // Keyboard shortcuts, ignored while an input box is being typed into
+            if (event.type == sf::Event::KeyPressed && std::none_of(inputBoxes.begin(), inputBoxes.end(), [](const InputBox& box) { return box.isActive; })) {
+                // Cycle the wall broadphase (Linear -> Grid -> BVH)
+                if (event.key.code == sf::Keyboard::B) {
+                    BroadphaseMode currentMode = simulation.wallBroadphase.mode;
+                    BroadphaseMode nextMode = currentMode == BroadphaseMode::Linear ? BroadphaseMode::Grid
+                        : currentMode == BroadphaseMode::Grid ? BroadphaseMode::Bvh
+                        : BroadphaseMode::Linear;
+                    simulation.setBroadphaseMode(nextMode);
+                }
+                // Toggle ball-ball collisions
+                else if (event.key.code == sf::Keyboard::C) {
+                    simulation.ballCollisions = !simulation.ballCollisions;
+                }
+                // Switch between the frame-step and the event-driven engine
+                else if (event.key.code == sf::Keyboard::E) {
+                    simulation.setEventEngine(!simulation.eventEngine);
+                }
+                // Switch between fixed-step and frame-time physics
+                else if (event.key.code == sf::Keyboard::F) {
+                    fixedStep = !fixedStep;
+                    accumulator = 0;
+                }
+                // Halve or double the fixed step size
+                else if (event.key.code == sf::Keyboard::LBracket) {
+                    fixedTimeStep = std::max(fixedTimeStep * 0.5f, minFixedTimeStep);
+                }
+                else if (event.key.code == sf::Keyboard::RBracket) {
+                    fixedTimeStep = std::min(fixedTimeStep * 2.0f, maxFixedTimeStep);
+                }
+                // Switch between smooth circles and points
+                else if (event.key.code == sf::Keyboard::R) {
+                    particleRenderer.quality = particleRenderer.quality == RenderQuality::Circles ? RenderQuality::Points : RenderQuality::Circles;
+                }
+                // Turn the update scheduler's level of detail on or off
+                else if (event.key.code == sf::Keyboard::L) {
+                    simulation.levelOfDetail = !simulation.levelOfDetail;
+                }
+                // Stop the running spawn batches; the balls spawned so far stay
+                else if (event.key.code == sf::Keyboard::Escape) {
+                    simulation.cancelSpawns();
+                }
+                // Save the scene to the snapshot file, or replace it with the saved one
+                else if (event.key.code == sf::Keyboard::S) {
+                    if (!saveSnapshot(simulation, snapshotPath)) {
+                        triggerErrorMessage("Cannot save " + snapshotPath);
+                    }
+                }
+                // Start or stop recording the particles to the trajectory file, or with Shift their bounces to the event file
+                else if (event.key.code == sf::Keyboard::T) {
+                    if (replaying) {
+                        triggerErrorMessage("Stop the replay first [P]");
+                    }
+                    else if (event.key.shift) {
+                        if (simulation.eventRecorder.isRecording()) {
+                            if (!simulation.eventRecorder.stop()) {
+                                triggerErrorMessage("Cannot write " + eventPath);
+                            }
+                        }
+                        else if (simulation.eventRecorder.start(eventPath)) {
+                            replayPath = eventPath;
+                        }
+                        else {
+                            triggerErrorMessage("Cannot create " + eventPath);
+                        }
+                    }
+                    else if (simulation.recorder.isRecording()) {
+                        if (!simulation.recorder.stop()) {
+                            triggerErrorMessage("Cannot write " + trajectoryPath);
+                        }
+                    }
+                    else if (simulation.recorder.start(trajectoryPath, recordInterval)) {
+                        replayPath = trajectoryPath;
+                    }
+                    else {
+                        triggerErrorMessage("Cannot create " + trajectoryPath);
+                    }
+                }
+                // Replay the recording started last, or go back to the live simulation
+                else if (event.key.code == sf::Keyboard::P) {
+                    if (replaying) {
+                        replaying = false;
+                        player.close();
+                    }
+                    else {
+                        bool events = replayPath == eventPath;
+                        if (events ? simulation.eventRecorder.isRecording() && !simulation.eventRecorder.stop() : simulation.recorder.isRecording() && !simulation.recorder.stop()) {
+                            triggerErrorMessage("Cannot write " + replayPath);
+                        }
+                        else if (player.open(replayPath)) {
+                            replaying = true;
+                            replayPaused = false;
+                            replaySpeed = 1.0;
+                            replayTime = player.getStartTime();
+                        }
+                        else {
+                            triggerErrorMessage("Cannot replay " + replayPath);
+                        }
+                    }
+                    accumulator = 0;
+                }
+                // Replay controls: pause, jump back or ahead, change the speed, restart
+                else if (replaying && event.key.code == sf::Keyboard::Space) {
+                    replayPaused = !replayPaused;
+                }
+                else if (replaying && event.key.code == sf::Keyboard::Left) {
+                    replayTime = std::max(replayTime - replaySkip, player.getStartTime());
+                }
+                else if (replaying && event.key.code == sf::Keyboard::Right) {
+                    replayTime = std::min(replayTime + replaySkip, player.getEndTime());
+                }
+                else if (replaying && event.key.code == sf::Keyboard::Up) {
+                    replaySpeed = std::min(replaySpeed * 2.0, maxReplaySpeed);
+                }
+                else if (replaying && event.key.code == sf::Keyboard::Down) {
+                    replaySpeed = std::max(replaySpeed * 0.5, minReplaySpeed);
+                }
+                else if (replaying && event.key.code == sf::Keyboard::Home) {
+                    replayTime = player.getStartTime();
+                }
+                else if (event.key.code == sf::Keyboard::O) {
+                    if (loadSnapshot(simulation, snapshotPath)) {
+                        wallShapes.clear();
+                        for (const Wall& wall : simulation.walls) {
+                            wallShapes.push_back(createWallShape(wall));
+                        }
+                        accumulator = 0;
+                    }
+                    else {
+                        triggerErrorMessage("Cannot load " + snapshotPath);
+                    }
+                }
+                // Add the balls of the particle file to the scene
+                else if (event.key.code == sf::Keyboard::I) {
+                    if (!importParticles(simulation, importPath, 3.0f, slateBlue.toInteger())) {
+                        triggerErrorMessage("Cannot import " + importPath);
+                    }
+                }
+                // Replace the scene with the one described in the scenario file
+                else if (event.key.code == sf::Keyboard::N) {
+                    if (openScenario(scenarioPath)) {
+                        accumulator = 0;
+                    }
+                    else {
+                        triggerErrorMessage("Cannot load " + scenarioPath);
+                    }
+                }
+            }
+
+            // Left click or drag on the replay bar: jump to that point of the recording
+            if (replaying && event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left
+                && replayBarArea.contains(window.mapPixelToCoords(sf::Vector2i(event.mouseButton.x, event.mouseButton.y)))) {
+                scrubbing = true;
+            }
+            if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Left) {
+                scrubbing = false;
+            }
+            if (replaying && scrubbing) {
+                float share = std::clamp((window.mapPixelToCoords(sf::Mouse::getPosition(window)).x - replayBar.getPosition().x) / replayBar.getSize().x, 0.0f, 1.0f);
+                replayTime = player.getStartTime() + share * (player.getEndTime() - player.getStartTime());
+            }
+
+            // Right click in the display area: remove the balls around the cursor
+            if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Right) {
+                sf::Vector2f cursor = window.mapPixelToCoords(sf::Vector2i(event.mouseButton.x, event.mouseButton.y));
+                if (displayArea.getGlobalBounds().contains(cursor)) {
+                    simulation.postRemoval({}, { sf::FloatRect(cursor.x - eraserSize / 2, cursor.y - eraserSize / 2, eraserSize, eraserSize) });
+                }
+            }
+
             // Check for mouse clicks to activate input boxes
             if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left) {
                 sf::Vector2f mousePos = window.mapPixelToCoords(sf::Mouse::getPosition(window));
@@ -463,7 +653,7 @@ int main() {
                     float startAngle, endAngle;
                     float startVelocity, endVelocity;
                     float radius = 3.0f;
-                    sf::Color color = sf::Color{ slateBlue };
+                    std::uint32_t color = slateBlue.toInteger();
 
                     switch (activeForm) {
                     case 1: // Handling for Form 1
@@ -490,13 +680,16 @@ int main() {
 
                         if (N > 0 && startX >= 0 && startY >= 0 && endX >= 0 && endY >= 0 && speed >= 0 &&
                             startX <= WINDOW_WIDTH - SIDEBAR_WIDTH && startY <= WINDOW_HEIGHT && endX <= WINDOW_WIDTH - SIDEBAR_WIDTH && endY <= WINDOW_HEIGHT) {
-                            for (int i = 0; i < N; ++i) {
-                                float t = (float)i / (N - 1); // Calculate interpolation parameter
-                                x = startX + t * (endX - startX); // Interpolate X
-                                y = startY + t * (endY - startY); // Interpolate Y
-                                Ball newBall(x, y, radius, color, speed, angle);
-                                addBallSafely(newBall);
-                            }
+                            // N balls on the line from start to end, generated by the simulation in parallel
+                            SpawnBatch batch;
+                            batch.count = N;
+                            batch.startPosition = sf::Vector2f(startX, startY);
+                            batch.endPosition = sf::Vector2f(endX, endY);
+                            batch.startAngle = batch.endAngle = angle;
+                            batch.startSpeed = batch.endSpeed = speed;
+                            batch.radius = radius;
+                            batch.color = color;
+                            simulation.post(batch);
                         }
                         else {
                             std::cerr << "Invalid input: values must be non-negative and within screen bounds." << std::endl;
@@ -527,12 +720,16 @@ int main() {
 
                         if (N > 0 && x >= 0 && y >= 0 && startAngle >= 0 && endAngle >= 0 && speed >= 0 &&
                             x <= WINDOW_WIDTH - SIDEBAR_WIDTH && y <= WINDOW_HEIGHT) {
-                            for (int i = 0; i < N; ++i) {
-                                float t = (float)i / (N - 1); // Calculate interpolation parameter
-                                angle = startAngle + t * (endAngle - startAngle); // Interpolate Angle
-                                Ball newBall(x, y, radius, color, speed, angle);
-                                addBallSafely(newBall);
-                            }
+                            // N balls fanned out from startAngle to endAngle
+                            SpawnBatch batch;
+                            batch.count = N;
+                            batch.startPosition = batch.endPosition = sf::Vector2f(x, y);
+                            batch.startAngle = startAngle;
+                            batch.endAngle = endAngle;
+                            batch.startSpeed = batch.endSpeed = speed;
+                            batch.radius = radius;
+                            batch.color = color;
+                            simulation.post(batch);
                         }
                         else {
                             std::cerr << "Invalid input: values must be non-negative and within screen bounds." << std::endl;
@@ -562,12 +759,16 @@ int main() {
 
                         if (N > 0 && x >= 0 && y >= 0 && angle >= 0 && startVelocity >= 0 && endVelocity >= 0 &&
                             x <= WINDOW_WIDTH - SIDEBAR_WIDTH && y <= WINDOW_HEIGHT) {
-                            for (int i = 0; i < N; ++i) {
-                                float t = (float)i / (N - 1); // Calculate interpolation parameter
-                                speed = startVelocity + t * (endVelocity - startVelocity); // Interpolate Velocity
-                                Ball newBall(x, y, radius, color, speed, angle);
-                                addBallSafely(newBall);
-                            }
+                            // N balls with speeds from startVelocity to endVelocity
+                            SpawnBatch batch;
+                            batch.count = N;
+                            batch.startPosition = batch.endPosition = sf::Vector2f(x, y);
+                            batch.startAngle = batch.endAngle = angle;
+                            batch.startSpeed = startVelocity;
+                            batch.endSpeed = endVelocity;
+                            batch.radius = radius;
+                            batch.color = color;
+                            simulation.post(batch);
                         }
                         else {
                             std::cerr << "Invalid input: values must be non-negative and within screen bounds." << std::endl;
@@ -595,8 +796,7 @@ int main() {
 
                         if (x >= 0 && y >= 0 && angle >= 0 && speed >= 0 &&
                             x <= WINDOW_WIDTH - SIDEBAR_WIDTH && y <= WINDOW_HEIGHT) {
-                            Ball newBall(x, y, radius, color, speed, angle);
-                            addBallSafely(newBall);
+                            simulation.post({ Ball(x, y, radius, color, speed, angle) });
                         }
                         else {
                             std::cerr << "Invalid input: values must be non-negative and within screen bounds." << std::endl;
@@ -632,7 +832,9 @@ int main() {
                     {
                         // Check if the input values are within the display area
                         if (displayArea.getGlobalBounds().contains(x1, y1) && displayArea.getGlobalBounds().contains(x2, y2)) {
-                            walls.emplace_back(sf::Vector2f(x1, WINDOW_HEIGHT - y1), sf::Vector2f(x2, WINDOW_HEIGHT - y2)); // Create a new wall and add it to the vector
+                            Wall wall(sf::Vector2f(x1, WINDOW_HEIGHT - y1), sf::Vector2f(x2, WINDOW_HEIGHT - y2)); // Create a new wall; the simulation adds it at the start of the next step
+                            simulation.post({}, { wall });
+                            wallShapes.push_back(createWallShape(wall));
                         }
                         else {
                             std::cout << "Wall coordinates must be within the display area!" << std::endl;
@@ -666,8 +868,40 @@ int main() {
             }
         }
 
-        // Update balls in parallel
-        updateBallsInParallel(balls, displayArea, walls, deltaTime);
+        if (replaying) {
+            // Replay: advance through the recording and decode the frame to show; the live simulation waits
+            if (!replayPaused && !scrubbing) {
+                replayTime = std::min(replayTime + deltaTime * replaySpeed, player.getEndTime());
+            }
+            player.seek(replayTime, simulation.threadPool);
+        }
+        else {
+            // Update balls in parallel
+            physicsClock.restart();
+            if (fixedStep) {
+                // Simulate the frame time in fixed steps and carry the remainder over to the next frame
+                accumulator += deltaTime;
+                int steps = 0;
+                while (accumulator >= fixedTimeStep && steps < maxStepsPerFrame) {
+                    simulation.step(fixedTimeStep);
+                    accumulator -= fixedTimeStep;
+                    ++steps;
+                }
+
+                // Too far behind: drop the steps that did not fit instead of carrying them into later frames
+                if (accumulator >= fixedTimeStep) {
+                    unsigned int dropped = static_cast<unsigned int>(accumulator / fixedTimeStep);
+                    droppedSteps += dropped;
+                    accumulator -= dropped * fixedTimeStep;
+                }
+                physicsSteps += steps;
+            }
+            else {
+                simulation.step(deltaTime);
+                ++physicsSteps;
+            }
+            physicsSeconds += physicsClock.getElapsedTime().asSeconds();
+        }
 
         window.clear(columbiaBlue);
 
@@ -697,11 +931,24 @@ int main() {
             window.draw(buttonText);
         }
 
-        updateBalls(static_cast<float>(deltaTime), displayArea, walls, frameCount);
-        drawBalls(window);
-
-        for (auto& wall : walls) {
-            wall.draw(window);
+        // Recordings hold only the balls, so the walls are left out while replaying
+        if (replaying) {
+            particleRenderer.draw(window, player.getParticles(), simulation.threadPool, renderGrainSize);
+            replayProgress.setSize(sf::Vector2f(replayBar.getSize().x * static_cast<float>(player.getEndTime() > player.getStartTime()
+                ? (player.getTime() - player.getStartTime()) / (player.getEndTime() - player.getStartTime()) : 1.0), replayBar.getSize().y));
+            char status[128];
+            std::snprintf(status, sizeof(status), "Replay: %.2f of %.2f s  Speed: x%g [Up/Down]  %s [Space]  Skip [Left/Right]  Live [P]",
+                player.getTime(), player.getEndTime(), replaySpeed, replayPaused ? "Paused" : "Playing");
+            replayText.setString(status);
+            window.draw(replayBar);
+            window.draw(replayProgress);
+            window.draw(replayText);
+        }
+        else {
+            particleRenderer.draw(window, simulation.particles, simulation.threadPool, renderGrainSize);
+            for (const auto& wallShape : wallShapes) {
+                window.draw(wallShape);
+            }
         }
 
         frameCount++; // Increment frame count
@@ -710,11 +957,68 @@ int main() {
         if (displayClock.getElapsedTime().asSeconds() >= 1.f) {
             float fps = frameCount / fpsClock.restart().asSeconds(); // Calculate FPS
             fpsText.setString("FPS: " + std::to_string(static_cast<int>(fps)));
+            char stats[288];
+            char stepMode[32];
+            if (fixedStep) {
+                std::snprintf(stepMode, sizeof(stepMode), "Fixed: %d Hz [F]", static_cast<int>(std::round(1.0f / fixedTimeStep)));
+            }
+            else {
+                std::snprintf(stepMode, sizeof(stepMode), "Frame time [F]");
+            }
+            // Busy share of the least and the most loaded thread over the last second; a wide spread means one thread holds the others up
+            double minBusy = 100.0;
+            double maxBusy = 0.0;
+            for (const ThreadLoad& load : simulation.threadPool.getLoad()) {
+                double total = load.busySeconds + load.idleSeconds;
+                double busy = total > 0 ? load.busySeconds * 100.0 / total : 0.0;
+                minBusy = std::min(minBusy, busy);
+                maxBusy = std::max(maxBusy, busy);
+            }
+            simulation.threadPool.resetLoad();
+
+            // Share of the balls the update scheduler moved in the last step
+            char lodMode[32];
+            bool scheduling = simulation.levelOfDetail && !simulation.eventEngine && !simulation.ballCollisions && !simulation.walls.empty() && !simulation.particles.empty();
+            if (scheduling) {
+                std::snprintf(lodMode, sizeof(lodMode), "On [L]  Moved: %.0f%%", simulation.updateScheduler.getLastUpdateCount() * 100.0 / simulation.particles.size());
+            }
+            else {
+                std::snprintf(lodMode, sizeof(lodMode), "%s [L]", simulation.levelOfDetail ? "On" : "Off");
+            }
+            char recording[64];
+            if (simulation.recorder.isRecording()) {
+                std::snprintf(recording, sizeof(recording), "%llu frames, %llu dropped [T]", static_cast<unsigned long long>(simulation.recorder.getRecordedFrames()),
+                    static_cast<unsigned long long>(simulation.recorder.getDroppedFrames()));
+            }
+            else if (simulation.eventRecorder.isRecording()) {
+                std::snprintf(recording, sizeof(recording), "%llu events, %.1f MB [Shift+T]", static_cast<unsigned long long>(simulation.eventRecorder.getRecordedEvents()),
+                    simulation.eventRecorder.getWrittenBytes() / 1e6);
+            }
+            else {
+                std::snprintf(recording, sizeof(recording), "Off [T]");
+            }
+            std::snprintf(stats, sizeof(stats), "Walls: %s [B]  Balls: %s [C]\nEngine: %s [E]  %s\nStep: %.2f ms  Drop: %llu  Busy: %.0f-%.0f%%\nDraw: %s [R]  SIMD: %s\nLOD: %s\nRecord: %s",
+                simulation.wallBroadphase.getModeName(), simulation.ballCollisions ? "On" : "Off", simulation.eventEngine ? "Event" : "Step", stepMode,
+                physicsSteps > 0 ? physicsSeconds * 1000.0f / physicsSteps : 0.0f, droppedSteps, minBusy, maxBusy, particleRenderer.getQualityName(), getSimdLevelName(simulation.simdLevel), lodMode, recording);
+            statsText.setString(stats);
+            physicsSeconds = 0;
+            physicsSteps = 0;
             frameCount = 0; // Reset frame count and restart the display clock
             displayClock.restart();
         }
 
         window.draw(fpsText);
+        window.draw(statsText);
+
+        // Spawn progress, updated every frame while large batches come alive
+        size_t spawnTotal = simulation.getSpawnTotal();
+        if (spawnTotal > 0) {
+            size_t spawned = simulation.getSpawnedCount();
+            char progress[64];
+            std::snprintf(progress, sizeof(progress), "Spawning: %.1fM of %.1fM (%d%%) [Esc]", spawned / 1e6, spawnTotal / 1e6, static_cast<int>(spawned * 100 / spawnTotal));
+            spawnText.setString(progress);
+            window.draw(spawnText);
+        }
 
         if (showError) {
             // Check if the error display time has elapsed
@@ -762,6 +1066,21 @@ sf::Text createInputLabel(const std::string& content, sf::Font& font, unsigned i
     return label;
 }
 
+// Creates the shape a wall is drawn with: a Wall::thickness high rectangle from start to end, centered on the wall's line.
+sf::RectangleShape createWallShape(const Wall& wall) {
+    sf::Vector2f direction = wall.end - wall.start;
+    float length = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+    sf::RectangleShape shape(sf::Vector2f(length, Wall::thickness));
+    shape.setOrigin(0, Wall::thickness / 2); // Origin is at the middle of the left edge
+    shape.setPosition(wall.start);
+
+    // Calculation for the angle to rotate the wall
+    float angle = std::atan2(direction.y, direction.x) * 180 / pi;
+    shape.setRotation(angle);
+    shape.setFillColor(slateBlue);
+    return shape;
+}
+
 // Creates a rectangular button with specified dimensions and position. The color is set to cornFlower. It also includes text on the button, and adds it to a vector for later rendering.
 sf::RectangleShape createTextButton(float x, float y, float width, float height, const std::string& textContent, sf::Font& font, std::vector<sf::Text>& buttonTexts) {
     sf::RectangleShape button;
@@ -783,35 +1102,6 @@ sf::RectangleShape createTextButton(float x, float y, float width, float height,
     return button;
 }
 
-// Calculates the reflection of a vector (velocity) off a surface with a given normal vector, using the reflection formula.
-sf::Vector2f reflect(const sf::Vector2f& velocity, const sf::Vector2f& normal) {
-    return velocity - 2 * (velocity.x * normal.x + velocity.y * normal.y) * normal;
-}
-
-// Computes the normal (perpendicular) vector to a Wall object, which is used in collision reflection calculations.
-sf::Vector2f getWallCollision(const Wall& wall) {
-    sf::Vector2f direction = wall.end - wall.start;     // Calculate direction vector of the wall
-    sf::Vector2f normal(-direction.y, direction.x);     // Calculate normal (perpendicular) vector
-    float length = std::sqrt(normal.x * normal.x + normal.y * normal.y);     // Normalize the normal vector
-    normal /= length;
-    return normal;
-}
-
-// Iteratively updates a subset of all balls' positions and checks for collisions to maintain performance across frames.
-void updateBalls(float deltaTime, const sf::RectangleShape& displayArea, const std::vector<Wall>& walls, int currentFrame) {
-    // Only update a subset of balls to maintain high FPS
-    for (int i = currentFrame % updateInterval; i < balls.size(); i += updateInterval) {
-        balls[i].update(displayArea, walls, deltaTime); // Update the ball's position and check for collisions
-    }
-}
-
-// Draws all balls on the window.
-void drawBalls(sf::RenderWindow& window) {
-    for (const auto& ball : balls) {
-        ball.draw(window);
-    }
-}
-
 // Function that updates the set of input boxes displayed in the sidebar based on the active form selection (or radio buttons).
 void updateInputBoxes(std::vector<InputBox>& inputBoxes, sf::Font& font, float startY, int form) {
     inputBoxes.clear();
@@ -861,44 +1151,28 @@ void updateInputBoxes(std::vector<InputBox>& inputBoxes, sf::Font& font, float s
     inputBoxes.emplace_back(sf::Vector2f(WINDOW_WIDTH - SIDEBAR_WIDTH + 10, wallInputsStartY + 105), sf::Vector2f(SIDEBAR_WIDTH - 20, INPUT_HEIGHT), "Y2:", font);
 }
 
-// Updates the positions of all Ball objects in parallel using multithreading to handle a large numbers of balls efficiently.
-void updateBallsInParallel(std::vector<Ball>& balls, const sf::RectangleShape& boundary, const std::vector<Wall>& walls, float deltaTime) {
-    const size_t numThreads = std::thread::hardware_concurrency();
-    const size_t totalBalls = balls.size();
-    const size_t chunkSize = totalBalls / numThreads;
-    size_t remainingBalls = totalBalls % numThreads;
-
-    std::vector<std::future<void>> futures(numThreads);
-
-    size_t startIdx = 0;
-    for (size_t i = 0; i < numThreads; ++i) {
-        size_t ballsToProcess = chunkSize + (remainingBalls > 0 ? 1 : 0);
-        if (remainingBalls > 0) {
-            --remainingBalls;
-        }
+// Shows message (by default the input error) in the corner of the display area for a few seconds.
+void triggerErrorMessage(const std::string& message) {
+    errorMessage.setString(message);
+    errorMessage.setPosition(WINDOW_WIDTH - SIDEBAR_WIDTH - errorMessage.getLocalBounds().width - 10, 10);
+    showError = true;
+    errorClock.restart();
+}
 
-        size_t endIdx = startIdx + ballsToProcess;
-        futures[i] = std::async(std::launch::async, [startIdx, endIdx, &balls, &boundary, &walls, deltaTime]() {
-            for (size_t j = startIdx; j < endIdx; ++j) {
-                balls[j].update(boundary, walls, deltaTime);
-            }
-            });
-        startIdx = endIdx;
+// Replaces the scene with the scenario file at path and takes over its step length, within the range [ and ] allow. Returns false, leaving the scene as it was, if the file cannot be read.
+bool openScenario(const std::string& path) {
+    Scenario scenario;
+    if (!readScenario(path, scenario)) {
+        return false;
     }
-
-    for (auto& future : futures) {
-        future.get();
+    applyScenario(simulation, scenario);
+    if (scenario.stepLength) {
+        fixedTimeStep = std::clamp(*scenario.stepLength, minFixedTimeStep, maxFixedTimeStep);
     }
-}
-
-// Safely adds a new ball to the global balls vector using mutex locking to prevent concurrent access issues with multithreading.
-void addBallSafely(const Ball& ball) {
-    std::lock_guard<std::mutex> guard(vectorMutex);
-    balls.push_back(ball);
-}
-
-// Allows the error message to be shown when there is an error with the input.
-void triggerErrorMessage() {
-    showError = true;
-    errorClock.restart();
+    wallShapes.clear();
+    wallShapes.reserve(simulation.walls.size());
+    for (const Wall& wall : simulation.walls) {
+        wallShapes.push_back(createWallShape(wall));
+    }
+    return true;
 }
@@ -0,0 +1,450 @@
+#include "simulation.h"
+#include <iostream>
+#include <cstring>
+
+// Trajectory files: the positions and velocities of all particles at every recorded step, written by the TrajectoryRecorder and read by the TrajectoryPlayer.
+// Layout: a TrajectoryHeader, one frame after another, then an index of all frames (one TrajectoryIndexEntry each) and a TrajectoryFooter that says where the index starts. A file whose recording was cut short has no index; the player then finds the frames by walking from one frame header to the next.
+// A frame is a TrajectoryFrameHeader and a payload. The payload splits the particles into blocks of trajectoryBlockSize: first the size in bytes of every block as a uint32, then the blocks. A block holds the x, y, vx and vy values of its particles, one array after the other, and in keyframes also their radius as floats and their color as uint32 values.
+// Positions and velocities are quantized to integers (1/positionScale pixels, 1/velocityScale pixels per second). A keyframe stores them as they are; the other frames store the change since the previous frame, which is small for particles that move steadily. Each integer is zigzag-encoded (small negative numbers become small positive ones) and written as a variable-length integer of 7 bits per byte, lowest group first, with the top bit set on all bytes but the last.
+
+const char trajectoryMagic[8] = { 'B', 'B', 'T', 'R', 'A', 'J', '\r', '\n' };
+const char trajectoryIndexMagic[8] = { 'B', 'B', 'T', 'I', 'N', 'D', 'E', 'X' };
+const uint32_t trajectoryVersion = 2;
+const uint32_t trajectoryFrameMarker = 0x4D415246; // "FRAM", tells a frame header from the index when walking the frames
+const float trajectoryPositionScale = 256.0f;
+const float trajectoryVelocityScale = 256.0f;
+
+struct TrajectoryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t interval; // Steps between recorded frames
+    uint32_t keyframeInterval;
+    float positionScale;
+    float velocityScale;
+};
+
+struct TrajectoryFrameHeader {
+    uint32_t marker; // trajectoryFrameMarker
+    uint32_t flags; // trajectoryKeyframe
+    uint64_t step;
+    double time;
+    uint64_t particleCount;
+    uint64_t payloadSize; // Bytes of the payload that follows
+};
+
+struct TrajectoryFooter {
+    uint64_t indexOffset;
+    uint64_t frameCount;
+    char magic[8]; // trajectoryIndexMagic
+};
+
+// Appends the quantized values of one array, as they are for a keyframe and as changes to previous otherwise, and stores them in previous for the next frame. output must have room for 10 bytes per value; returns the end of what was written.
+static uint8_t* encodeTrajectoryArray(const float* values, size_t count, float scale, bool keyframe, int64_t* previous, uint8_t* output) {
+    for (size_t i = 0; i < count; ++i) {
+        int64_t quantized = std::llrint(static_cast<double>(values[i]) * scale);
+        int64_t change = keyframe ? quantized : quantized - previous[i];
+        previous[i] = quantized;
+        uint64_t zigzag = (static_cast<uint64_t>(change) << 1) ^ static_cast<uint64_t>(change >> 63);
+        while (zigzag >= 0x80) {
+            *output++ = static_cast<uint8_t>(zigzag | 0x80);
+            zigzag >>= 7;
+        }
+        *output++ = static_cast<uint8_t>(zigzag);
+    }
+    return output;
+}
+
+// The inverse of encodeTrajectoryArray. Reads no further than end; values past it are taken as 0. Returns the end of what was read.
+static const uint8_t* decodeTrajectoryArray(const uint8_t* input, const uint8_t* end, size_t count, bool keyframe, int64_t* values) {
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t zigzag = 0;
+        for (int shift = 0; input < end && shift < 64; shift += 7) {
+            uint8_t byte = *input++;
+            zigzag |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                break;
+            }
+        }
+        int64_t change = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+        values[i] = keyframe ? change : values[i] + change;
+    }
+    return input;
+}
+
+// Creates the trajectory file at path and writes its header. Prints the reason and returns nullptr if that fails.
+std::FILE* openTrajectoryFile(const std::string& path, size_t interval) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Cannot create trajectory file " << path << std::endl;
+        return nullptr;
+    }
+    TrajectoryHeader header{};
+    std::memcpy(header.magic, trajectoryMagic, sizeof(header.magic));
+    header.version = trajectoryVersion;
+    header.headerSize = sizeof(TrajectoryHeader);
+    header.interval = static_cast<uint32_t>(interval);
+    header.keyframeInterval = static_cast<uint32_t>(recorderKeyframeInterval);
+    header.positionScale = trajectoryPositionScale;
+    header.velocityScale = trajectoryVelocityScale;
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::cerr << "Cannot write trajectory file " << path << std::endl;
+        std::fclose(file);
+        return nullptr;
+    }
+    return file;
+}
+
+// Encodes the frame, as changes to the previous one the encoder has seen unless it is a keyframe, and appends it to the file. Returns false if writing failed.
+bool writeTrajectoryFrame(std::FILE* file, const TrajectoryFrame& frame, TrajectoryEncoder& encoder) {
+    size_t count = frame.x.size();
+    if (frame.keyframe) {
+        encoder.x.resize(count);
+        encoder.y.resize(count);
+        encoder.vx.resize(count);
+        encoder.vy.resize(count);
+    }
+
+    size_t blockCount = (count + trajectoryBlockSize - 1) / trajectoryBlockSize;
+    size_t tableSize = blockCount * sizeof(uint32_t);
+    encoder.buffer.resize(tableSize + count * (4 * 10 + 8));
+    uint8_t* output = encoder.buffer.data() + tableSize;
+    for (size_t block = 0; block < blockCount; ++block) {
+        size_t first = block * trajectoryBlockSize;
+        size_t blockLength = std::min(trajectoryBlockSize, count - first);
+        uint8_t* blockStart = output;
+        output = encodeTrajectoryArray(frame.x.data() + first, blockLength, trajectoryPositionScale, frame.keyframe, encoder.x.data() + first, output);
+        output = encodeTrajectoryArray(frame.y.data() + first, blockLength, trajectoryPositionScale, frame.keyframe, encoder.y.data() + first, output);
+        output = encodeTrajectoryArray(frame.vx.data() + first, blockLength, trajectoryVelocityScale, frame.keyframe, encoder.vx.data() + first, output);
+        output = encodeTrajectoryArray(frame.vy.data() + first, blockLength, trajectoryVelocityScale, frame.keyframe, encoder.vy.data() + first, output);
+        if (frame.keyframe) {
+            std::memcpy(output, frame.radius.data() + first, blockLength * sizeof(float));
+            output += blockLength * sizeof(float);
+            std::memcpy(output, frame.color.data() + first, blockLength * sizeof(std::uint32_t));
+            output += blockLength * sizeof(std::uint32_t);
+        }
+        uint32_t blockSize = static_cast<uint32_t>(output - blockStart);
+        std::memcpy(encoder.buffer.data() + block * sizeof(uint32_t), &blockSize, sizeof(blockSize));
+    }
+
+    TrajectoryFrameHeader header{};
+    header.marker = trajectoryFrameMarker;
+    header.flags = frame.keyframe ? trajectoryKeyframe : 0;
+    header.step = frame.step;
+    header.time = frame.time;
+    header.particleCount = count;
+    header.payloadSize = static_cast<uint64_t>(output - encoder.buffer.data());
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1 || std::fwrite(encoder.buffer.data(), 1, header.payloadSize, file) != header.payloadSize) {
+        std::cerr << "Cannot write to the trajectory file" << std::endl;
+        return false;
+    }
+    encoder.index.push_back({ encoder.offset, header.step, header.time, header.particleCount, header.flags, 0 });
+    encoder.offset += sizeof(header) + header.payloadSize;
+    return true;
+}
+
+// Appends the index of the frames written so far and the footer that points to it. Returns false if writing failed.
+bool writeTrajectoryIndex(std::FILE* file, const TrajectoryEncoder& encoder) {
+    TrajectoryFooter footer{};
+    footer.indexOffset = encoder.offset;
+    footer.frameCount = encoder.index.size();
+    std::memcpy(footer.magic, trajectoryIndexMagic, sizeof(footer.magic));
+    if (std::fwrite(encoder.index.data(), sizeof(TrajectoryIndexEntry), encoder.index.size(), file) != encoder.index.size() || std::fwrite(&footer, sizeof(footer), 1, file) != 1) {
+        std::cerr << "Cannot write to the trajectory file" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Checks the header of the mapped trajectory file and reads its frame index, from the end of the file or, if the recording was cut short, by walking the frames. Prints the reason and returns false if the file is missing or not a trajectory file.
+bool readTrajectoryIndex(const std::string& path, const MappedFile& file, std::vector<TrajectoryIndexEntry>& index, float& positionScale, float& velocityScale) {
+    if (file.data == nullptr) {
+        std::cerr << "Cannot open trajectory file " << path << std::endl;
+        return false;
+    }
+    TrajectoryHeader header;
+    if (file.size < sizeof(header) || std::memcmp(file.data, trajectoryMagic, sizeof(trajectoryMagic)) != 0) {
+        std::cerr << path << " is not a trajectory file" << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.data, sizeof(header));
+    if (header.version != trajectoryVersion || header.headerSize != sizeof(TrajectoryHeader)) {
+        std::cerr << path << " has trajectory version " << header.version << ", expected " << trajectoryVersion << std::endl;
+        return false;
+    }
+    positionScale = header.positionScale;
+    velocityScale = header.velocityScale;
+
+    index.clear();
+    TrajectoryFooter footer{};
+    if (file.size >= sizeof(header) + sizeof(footer)) {
+        std::memcpy(&footer, file.data + file.size - sizeof(footer), sizeof(footer));
+    }
+    uint64_t indexSpace = file.size - sizeof(header) - sizeof(footer);
+    if (std::memcmp(footer.magic, trajectoryIndexMagic, sizeof(footer.magic)) == 0 && footer.frameCount <= indexSpace / sizeof(TrajectoryIndexEntry)
+        && footer.indexOffset + footer.frameCount * sizeof(TrajectoryIndexEntry) + sizeof(footer) == file.size) {
+        index.resize(footer.frameCount);
+        std::memcpy(index.data(), file.data + footer.indexOffset, footer.frameCount * sizeof(TrajectoryIndexEntry));
+    }
+    else {
+        uint64_t offset = sizeof(header);
+        TrajectoryFrameHeader frame;
+        while (offset + sizeof(frame) <= file.size) {
+            std::memcpy(&frame, file.data + offset, sizeof(frame));
+            if (frame.marker != trajectoryFrameMarker || frame.payloadSize > file.size - offset - sizeof(frame)) {
+                break;
+            }
+            index.push_back({ offset, frame.step, frame.time, frame.particleCount, frame.flags, 0 });
+            offset += sizeof(frame) + frame.payloadSize;
+        }
+    }
+
+    // Every frame must lie inside the file (and can hardly hold more particles than the file has bytes), and decoding has to start at a keyframe
+    for (const TrajectoryIndexEntry& entry : index) {
+        if (entry.offset > file.size - sizeof(TrajectoryFrameHeader) || entry.particleCount > file.size) {
+            std::cerr << "Trajectory file " << path << " is damaged" << std::endl;
+            return false;
+        }
+    }
+    if (index.empty() || (index.front().flags & trajectoryKeyframe) == 0) {
+        std::cerr << "Trajectory file " << path << " holds no frames" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Decodes one block of a frame on top of the quantized values x, y, vx and vy of the frame before it, which are indexed from the first particle of the frame. A keyframe also sets the radius and color of the block's particles, which must already exist. Damaged data decodes to wrong values but is never read past the frame.
+void decodeTrajectoryBlock(const MappedFile& file, const TrajectoryIndexEntry& frame, size_t block, int64_t* x, int64_t* y, int64_t* vx, int64_t* vy, ParticleStore& particles) {
+    TrajectoryFrameHeader header;
+    std::memcpy(&header, file.data + frame.offset, sizeof(header));
+    const uint8_t* payload = reinterpret_cast<const uint8_t*>(file.data) + frame.offset + sizeof(header);
+    const uint8_t* payloadEnd = payload + std::min<uint64_t>(header.payloadSize, file.size - frame.offset - sizeof(header));
+    size_t count = header.particleCount;
+    size_t blockCount = (count + trajectoryBlockSize - 1) / trajectoryBlockSize;
+    if (block >= blockCount || blockCount * sizeof(uint32_t) > static_cast<size_t>(payloadEnd - payload)) {
+        return;
+    }
+
+    // Skip the blocks before this one
+    const uint8_t* input = payload + blockCount * sizeof(uint32_t);
+    uint32_t blockSize = 0;
+    for (size_t i = 0; i <= block; ++i) {
+        input += blockSize;
+        std::memcpy(&blockSize, payload + i * sizeof(uint32_t), sizeof(blockSize));
+    }
+    if (input > payloadEnd || blockSize > static_cast<size_t>(payloadEnd - input)) {
+        return;
+    }
+    const uint8_t* end = input + blockSize;
+
+    size_t first = block * trajectoryBlockSize;
+    size_t blockLength = std::min(trajectoryBlockSize, count - first);
+    bool keyframe = (header.flags & trajectoryKeyframe) != 0;
+    input = decodeTrajectoryArray(input, end, blockLength, keyframe, x + first);
+    input = decodeTrajectoryArray(input, end, blockLength, keyframe, y + first);
+    input = decodeTrajectoryArray(input, end, blockLength, keyframe, vx + first);
+    input = decodeTrajectoryArray(input, end, blockLength, keyframe, vy + first);
+    if (keyframe && static_cast<size_t>(end - input) >= blockLength * (sizeof(float) + sizeof(std::uint32_t))) {
+        std::memcpy(particles.radius.pointer(first), input, blockLength * sizeof(float));
+        std::memcpy(particles.color.pointer(first), input + blockLength * sizeof(float), blockLength * sizeof(std::uint32_t));
+    }
+}
+
+// Event files: the particles of a run as the moments they changed course, written by the EventRecorder and read by the TrajectoryPlayer.
+// Layout: an EventFileHeader, then one record after another, each an EventRecordHeader and a payload. A keyframe record holds the state of every particle as arrays of x, y, vx, vy and radius floats and color uint32 values; a spawn record holds the state of particles added after the ones recorded so far in the same layout; an event batch record holds ParticleEvents as they are in memory, sorted by particle, their times counted from the time of the record. The first record is a keyframe, and the records are in time order, so the events of a particle come in the order they happened.
+// There is no index in the file: the player finds the records by walking from one header to the next, which also makes recordings that were cut short readable up to their last whole record.
+
+const char eventMagic[8] = { 'B', 'B', 'E', 'V', 'E', 'N', 'T', '\n' };
+const uint32_t eventVersion = 2; // Version 1 had events without their own time and a tolerance in the header
+const uint32_t eventKeyframeMarker = 0x4659454B; // "KEYF"
+const uint32_t eventSpawnMarker = 0x4E575053; // "SPWN"
+const uint32_t eventBatchMarker = 0x544E5645; // "EVNT"
+const size_t eventKeyframeBytes = 5 * sizeof(float) + sizeof(std::uint32_t); // Per particle, also of spawn records
+
+struct EventFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t reserved[2];
+};
+
+struct EventRecordHeader {
+    uint32_t marker; // eventKeyframeMarker, eventSpawnMarker or eventBatchMarker
+    uint32_t reserved;
+    double time;
+    uint64_t count; // Particles of a keyframe or spawn record, events of a batch
+};
+
+// Creates the event file at path and writes its header. Prints the reason and returns nullptr if that fails.
+std::FILE* openEventFile(const std::string& path) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Cannot create event file " << path << std::endl;
+        return nullptr;
+    }
+    EventFileHeader header{};
+    std::memcpy(header.magic, eventMagic, sizeof(header.magic));
+    header.version = eventVersion;
+    header.headerSize = sizeof(EventFileHeader);
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::cerr << "Cannot write event file " << path << std::endl;
+        std::fclose(file);
+        return nullptr;
+    }
+    return file;
+}
+
+// Appends the batch to the file as one record. Returns false if writing failed.
+bool writeEventBatch(std::FILE* file, const EventBatch& batch) {
+    EventRecordHeader header{};
+    bool states = batch.kind != EventBatch::Kind::Events;
+    header.marker = batch.kind == EventBatch::Kind::Keyframe ? eventKeyframeMarker : (states ? eventSpawnMarker : eventBatchMarker);
+    header.time = batch.time;
+    header.count = states ? batch.x.size() : batch.events.size();
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    if (states) {
+        for (const std::vector<float>* values : { &batch.x, &batch.y, &batch.vx, &batch.vy, &batch.radius }) {
+            written = written && std::fwrite(values->data(), sizeof(float), values->size(), file) == values->size();
+        }
+        written = written && std::fwrite(batch.color.data(), sizeof(std::uint32_t), batch.color.size(), file) == batch.color.size();
+    }
+    else {
+        written = written && std::fwrite(batch.events.data(), sizeof(ParticleEvent), batch.events.size(), file) == batch.events.size();
+    }
+    if (!written) {
+        std::cerr << "Cannot write to the event file" << std::endl;
+    }
+    return written;
+}
+
+// Whether the mapped file starts like an event file.
+bool isEventFile(const MappedFile& file) {
+    return file.data != nullptr && file.size >= sizeof(eventMagic) && std::memcmp(file.data, eventMagic, sizeof(eventMagic)) == 0;
+}
+
+// Checks the header of the mapped event file and splits its records into segments, one per keyframe. Stops at the first record that is not whole or not valid where it is. Prints the reason and returns false if the file is missing or not an event file.
+bool readEventSegments(const std::string& path, const MappedFile& file, std::vector<EventSegment>& segments) {
+    if (file.data == nullptr) {
+        std::cerr << "Cannot open event file " << path << std::endl;
+        return false;
+    }
+    EventFileHeader header;
+    if (file.size < sizeof(header) || !isEventFile(file)) {
+        std::cerr << path << " is not an event file" << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.data, sizeof(header));
+    if (header.version != eventVersion || header.headerSize != sizeof(EventFileHeader)) {
+        std::cerr << path << " has event file version " << header.version << ", expected " << eventVersion << std::endl;
+        return false;
+    }
+
+    segments.clear();
+    uint64_t offset = sizeof(header);
+    EventRecordHeader record;
+    while (offset + sizeof(record) <= file.size) {
+        std::memcpy(&record, file.data + offset, sizeof(record));
+        bool keyframe = record.marker == eventKeyframeMarker;
+        bool spawn = record.marker == eventSpawnMarker;
+        uint64_t space = file.size - offset - sizeof(record);
+        size_t valueSize = keyframe || spawn ? eventKeyframeBytes : sizeof(ParticleEvent);
+        if ((!keyframe && !spawn && record.marker != eventBatchMarker) || (!keyframe && segments.empty()) || record.count > space / valueSize) {
+            break;
+        }
+        uint64_t end = offset + sizeof(record) + record.count * valueSize;
+        if (keyframe) {
+            segments.push_back({ offset, end, end, record.time, record.time, record.count, 0 });
+        }
+        else {
+            segments.back().end = end;
+            segments.back().endTime = record.time;
+            (spawn ? segments.back().particleCount : segments.back().eventCount) += record.count;
+        }
+        offset = end;
+    }
+    if (segments.empty()) {
+        std::cerr << "Event file " << path << " holds no keyframe" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Builds the index of a segment with a counting sort of its events by particle. Events of particles the segment does not have at that point (damaged data) are left out.
+// A bounce at the very start of a step, like every ball collision, comes after the state recorded at the end of the step before, and particles spawned at the start of a step are not there yet at its end. Both are indexed just after that time, so seeking to a step shows what the run had then.
+void indexEventSegment(const MappedFile& file, const EventSegment& segment, EventIndex& index) {
+    size_t count = segment.particleCount;
+    // Calls states(time, first, count, payload) for the keyframe and every spawn record of the segment and events(time, event) for every event, in file order, with the event time counted from the start of the run
+    auto forEachRecord = [&](auto&& states, auto&& events) {
+        uint64_t offset = segment.keyframeOffset;
+        uint64_t known = 0;
+        double stepStart = segment.startTime;
+        EventRecordHeader record;
+        while (offset < segment.end) {
+            std::memcpy(&record, file.data + offset, sizeof(record));
+            const char* payload = file.data + offset + sizeof(record);
+            double afterStart = std::nextafter(stepStart, std::numeric_limits<double>::infinity());
+            if (record.marker != eventBatchMarker) {
+                states(known == 0 ? record.time : std::max(record.time, afterStart), known, record.count, payload);
+                known += record.count;
+                offset += sizeof(record) + record.count * eventKeyframeBytes;
+                continue;
+            }
+            for (uint64_t i = 0; i < record.count; ++i) {
+                ParticleEvent event;
+                std::memcpy(&event, payload + i * sizeof(event), sizeof(event));
+                if (event.particle < known) {
+                    events(std::max(record.time + event.time, afterStart), event);
+                }
+            }
+            stepStart = record.time;
+            offset += sizeof(record) + record.count * sizeof(ParticleEvent);
+        }
+    };
+
+    // Every particle has the state it was added with and then its events
+    index.first.assign(count + 1, 1);
+    index.first[0] = 0;
+    index.visibleTime.clear();
+    index.visibleCount.clear();
+    forEachRecord([&](double time, uint64_t first, uint64_t added, const char*) {
+        index.visibleTime.push_back(time);
+        index.visibleCount.push_back(first + added);
+        }, [&](double, const ParticleEvent& event) { ++index.first[event.particle + 1]; });
+    for (size_t i = 0; i < count; ++i) {
+        index.first[i + 1] += index.first[i];
+    }
+    size_t total = index.first[count];
+    index.time.resize(total);
+    index.x.resize(total);
+    index.y.resize(total);
+    index.vx.resize(total);
+    index.vy.resize(total);
+    index.radius.resize(count);
+    index.color.resize(count);
+
+    std::vector<uint64_t> next(count);
+    forEachRecord([&](double time, uint64_t first, uint64_t added, const char* payload) {
+        const char* arrays[6];
+        for (size_t array = 0; array < 6; ++array) {
+            arrays[array] = payload + array * added * sizeof(float);
+        }
+        for (uint64_t k = 0; k < added; ++k) {
+            uint64_t entry = index.first[first + k];
+            index.time[entry] = time;
+            std::memcpy(&index.x[entry], arrays[0] + k * sizeof(float), sizeof(float));
+            std::memcpy(&index.y[entry], arrays[1] + k * sizeof(float), sizeof(float));
+            std::memcpy(&index.vx[entry], arrays[2] + k * sizeof(float), sizeof(float));
+            std::memcpy(&index.vy[entry], arrays[3] + k * sizeof(float), sizeof(float));
+            next[first + k] = entry + 1;
+        }
+        std::memcpy(index.radius.data() + first, arrays[4], added * sizeof(float));
+        std::memcpy(index.color.data() + first, arrays[5], added * sizeof(std::uint32_t));
+        }, [&](double time, const ParticleEvent& event) {
+        uint64_t entry = next[event.particle]++;
+        index.time[entry] = time;
+        index.x[entry] = event.x;
+        index.y[entry] = event.y;
+        index.vx[entry] = event.vx;
+        index.vy[entry] = event.vy;
+        });
+}
@@ -0,0 +1,248 @@
+#include "simulation.h"
+#include <iostream>
+#include <charconv>
+#include <string_view>
+
+// Scenario files: a scene as text, one statement per line, so large scenes can be written by hand or generated instead of being typed into the sidebar forms.
+// Coordinates, angles and speeds mean the same as in the forms: x from the left and y from the bottom of the display area in pixels, angles in degrees, speeds in pixels per second. Everything after a # is a comment.
+//   wall X1 Y1 X2 Y2                          A wall from (X1, Y1) to (X2, Y2)
+//   ball X Y ANGLE SPEED                      A single ball
+//   line N START_X START_Y END_X END_Y ANGLE SPEED    N balls on a line, like batch form 1
+//   fan N X Y START_ANGLE END_ANGLE SPEED     N balls fanned out over the angles, like batch form 2
+//   burst N X Y ANGLE START_SPEED END_SPEED   N balls with speeds spread over the range, like batch form 3
+//   radius R                                  Radius of the balls of the following statements (3 by default, at most half the display height)
+//   color RRGGBB[AA]                          Their color, in hex (slate blue by default)
+//   engine step|event    broadphase linear|grid|bvh    collisions on|off    lod on|off    step SECONDS
+// The file is mapped into memory and the numbers are read with std::from_chars, which neither allocates nor depends on the locale, so even hundreds of thousands of walls load in milliseconds.
+
+const float scenarioDefaultRadius = 3.0f;
+const float scenarioMaxRadius = SIMULATION_HEIGHT / 2.0f; // The largest ball that fits in the display area, which bounds every value the forms take
+const std::uint32_t scenarioDefaultColor = 0x6E6E6EFF; // slateBlue, as the sidebar forms use
+
+// Reads the statements of one line. Each read skips the blanks before its token and fails at the end of the line.
+class ScenarioLine {
+public:
+    ScenarioLine(const char* begin, const char* end) : position(begin), end(end) {}
+
+    bool word(std::string_view& value) {
+        skipBlanks();
+        const char* start = position;
+        while (position < end && !isBlank(*position)) {
+            ++position;
+        }
+        value = std::string_view(start, position - start);
+        return !value.empty();
+    }
+
+    template <typename T>
+    bool number(T& value, int base = 10) {
+        skipBlanks();
+        std::from_chars_result result;
+        if constexpr (std::is_floating_point_v<T>) {
+            result = std::from_chars(position, end, value);
+        }
+        else {
+            result = std::from_chars(position, end, value, base);
+        }
+        if (result.ec != std::errc() || (result.ptr < end && !isBlank(*result.ptr))) {
+            return false;
+        }
+        position = result.ptr;
+        return true;
+    }
+
+    // on or off
+    bool flag(bool& value) {
+        std::string_view text;
+        if (!word(text) || (text != "on" && text != "off")) {
+            return false;
+        }
+        value = text == "on";
+        return true;
+    }
+
+    // Whether only blanks are left
+    bool finished() {
+        skipBlanks();
+        return position == end;
+    }
+
+private:
+    const char* position;
+    const char* end;
+
+    // Spaces and tabs, and the carriage return of Windows line ends
+    static bool isBlank(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    void skipBlanks() {
+        while (position < end && isBlank(*position)) {
+            ++position;
+        }
+    }
+};
+
+// Whether (x, y) in form coordinates lies in the display area
+static bool inDisplayArea(float x, float y) {
+    return x >= 0 && y >= 0 && x <= SIMULATION_WIDTH && y <= SIMULATION_HEIGHT;
+}
+
+// Reads the scenario file at path into scenario. Prints the reason, with the line number, and returns false if the file is missing or a line is not a valid statement; scenario is then incomplete.
+bool readScenario(const std::string& path, Scenario& scenario) {
+    scenario = Scenario();
+    MappedFile file(path);
+    if (file.data == nullptr) {
+        // An empty file is a valid, empty scenario
+        std::FILE* exists = std::fopen(path.c_str(), "rb");
+        if (exists == nullptr) {
+            std::cerr << "Cannot open scenario file " << path << std::endl;
+            return false;
+        }
+        std::fclose(exists);
+        return true;
+    }
+
+    float radius = scenarioDefaultRadius;
+    std::uint32_t color = scenarioDefaultColor;
+    const char* position = file.data;
+    const char* fileEnd = file.data + file.size;
+    for (size_t lineNumber = 1; position < fileEnd; ++lineNumber) {
+        const char* lineEnd = std::find(position, fileEnd, '\n');
+        ScenarioLine line(position, std::find(position, lineEnd, '#'));
+        position = lineEnd < fileEnd ? lineEnd + 1 : fileEnd;
+
+        std::string_view statement;
+        if (!line.word(statement)) {
+            continue; // Blank line or comment
+        }
+        // Whether the statement has the right values, and whether they are allowed
+        bool parsed = false;
+        bool allowed = true;
+        const char* rule = "values must be non-negative and within the display area";
+        if (statement == "wall") {
+            float x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+            parsed = line.number(x1) && line.number(y1) && line.number(x2) && line.number(y2) && line.finished();
+            allowed = parsed && inDisplayArea(x1, y1) && inDisplayArea(x2, y2);
+            if (allowed) {
+                scenario.walls.emplace_back(sf::Vector2f(x1, SIMULATION_HEIGHT - y1), sf::Vector2f(x2, SIMULATION_HEIGHT - y2));
+            }
+        }
+        else if (statement == "ball") {
+            float x = 0, y = 0, angle = 0, speed = 0;
+            parsed = line.number(x) && line.number(y) && line.number(angle) && line.number(speed) && line.finished();
+            allowed = parsed && inDisplayArea(x, y) && angle >= 0 && speed >= 0;
+            if (allowed) {
+                scenario.balls.emplace_back(x, y, radius, color, speed, angle);
+            }
+        }
+        else if (statement == "line" || statement == "fan" || statement == "burst") {
+            SpawnBatch batch;
+            float x = 0, y = 0;
+            if (statement == "line") {
+                float endX = 0, endY = 0, angle = 0, speed = 0;
+                parsed = line.number(batch.count) && line.number(x) && line.number(y) && line.number(endX) && line.number(endY) && line.number(angle) && line.number(speed) && line.finished();
+                allowed = parsed && inDisplayArea(endX, endY);
+                batch.endPosition = sf::Vector2f(endX, endY);
+                batch.startAngle = batch.endAngle = angle;
+                batch.startSpeed = batch.endSpeed = speed;
+            }
+            else if (statement == "fan") {
+                float speed = 0;
+                parsed = line.number(batch.count) && line.number(x) && line.number(y) && line.number(batch.startAngle) && line.number(batch.endAngle) && line.number(speed) && line.finished();
+                batch.endPosition = sf::Vector2f(x, y);
+                batch.startSpeed = batch.endSpeed = speed;
+            }
+            else {
+                float angle = 0;
+                parsed = line.number(batch.count) && line.number(x) && line.number(y) && line.number(angle) && line.number(batch.startSpeed) && line.number(batch.endSpeed) && line.finished();
+                batch.endPosition = sf::Vector2f(x, y);
+                batch.startAngle = batch.endAngle = angle;
+            }
+            batch.startPosition = sf::Vector2f(x, y);
+            batch.radius = radius;
+            batch.color = color;
+            allowed = allowed && parsed && batch.count > 0 && inDisplayArea(x, y) && batch.startAngle >= 0 && batch.endAngle >= 0 && batch.startSpeed >= 0 && batch.endSpeed >= 0;
+            rule = "the count must be positive and the values non-negative and within the display area";
+            if (allowed) {
+                scenario.batches.push_back(batch);
+            }
+        }
+        else if (statement == "radius") {
+            parsed = line.number(radius) && line.finished();
+            allowed = radius > 0 && radius <= scenarioMaxRadius;
+            rule = "the radius must be positive and the ball fit in the display area";
+        }
+        else if (statement == "color") {
+            std::string_view digits;
+            parsed = line.word(digits) && (digits.size() == 6 || digits.size() == 8) && line.finished() && ScenarioLine(digits.data(), digits.data() + digits.size()).number(color, 16);
+            if (parsed && digits.size() == 6) {
+                color = color << 8 | 0xFF; // Opaque
+            }
+        }
+        else if (statement == "engine") {
+            std::string_view engine;
+            parsed = line.word(engine) && (engine == "step" || engine == "event") && line.finished();
+            scenario.eventEngine = engine == "event";
+        }
+        else if (statement == "broadphase") {
+            std::string_view mode;
+            parsed = line.word(mode) && (mode == "linear" || mode == "grid" || mode == "bvh") && line.finished();
+            scenario.broadphase = mode == "linear" ? BroadphaseMode::Linear : mode == "grid" ? BroadphaseMode::Grid : BroadphaseMode::Bvh;
+        }
+        else if (statement == "collisions") {
+            bool enabled = false;
+            parsed = line.flag(enabled) && line.finished();
+            scenario.ballCollisions = enabled;
+        }
+        else if (statement == "lod") {
+            bool enabled = false;
+            parsed = line.flag(enabled) && line.finished();
+            scenario.levelOfDetail = enabled;
+        }
+        else if (statement == "step") {
+            float seconds = 0;
+            parsed = line.number(seconds) && line.finished();
+            allowed = seconds > 0;
+            rule = "the step length must be positive";
+            scenario.stepLength = seconds;
+        }
+        else {
+            std::cerr << path << ":" << lineNumber << ": unknown statement " << statement << std::endl;
+            return false;
+        }
+        if (!parsed) {
+            std::cerr << path << ":" << lineNumber << ": invalid " << statement << " statement" << std::endl;
+            return false;
+        }
+        if (!allowed) {
+            std::cerr << path << ":" << lineNumber << ": invalid " << statement << " statement: " << rule << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Replaces the scene of the simulation with the scenario: the settings it chose first, then all walls with one broadphase rebuild and all single balls at once. The spawn batches are queued and come alive over the next steps like those of the sidebar forms. The step length is left to the caller.
+void applyScenario(Simulation& simulation, const Scenario& scenario) {
+    simulation.clear();
+    if (scenario.eventEngine) {
+        simulation.setEventEngine(*scenario.eventEngine);
+    }
+    if (scenario.broadphase) {
+        simulation.setBroadphaseMode(*scenario.broadphase);
+    }
+    if (scenario.ballCollisions) {
+        simulation.ballCollisions = *scenario.ballCollisions;
+    }
+    if (scenario.levelOfDetail) {
+        simulation.levelOfDetail = *scenario.levelOfDetail;
+    }
+    if (!scenario.walls.empty()) {
+        simulation.addWalls(scenario.walls);
+    }
+    simulation.particles.append(scenario.balls);
+    for (const SpawnBatch& batch : scenario.batches) {
+        simulation.post(batch);
+    }
+}
@@ -0,0 +1,423 @@
+#include "simulation.h"
+
+// Calculates the reflection of a vector (velocity) off a surface with a given normal vector, using the reflection formula.
+sf::Vector2f reflect(const sf::Vector2f& velocity, const sf::Vector2f& normal) {
+    return velocity - 2 * (velocity.x * normal.x + velocity.y * normal.y) * normal;
+}
+
+// Computes the normal (perpendicular) vector to a Wall object, which is used in collision reflection calculations.
+sf::Vector2f getWallCollision(const Wall& wall) {
+    sf::Vector2f direction = wall.end - wall.start;     // Calculate direction vector of the wall
+    sf::Vector2f normal(-direction.y, direction.x);     // Calculate normal (perpendicular) vector
+    float length = std::sqrt(normal.x * normal.x + normal.y * normal.y);     // Normalize the normal vector
+    normal /= length;
+    return normal;
+}
+
+// Finds when a ball of the given radius, with its center moving from center at velocity, first touches the wall, which is treated as a capsule as thick as it is drawn. Only times in [0, maxTime] count, and a ball moving away from the wall never hits it, so a ball that just bounced off a wall is not caught by it again. On a hit, returns the time and the unit normal at the contact pointing towards the ball.
+bool sweptCircleWallHit(sf::Vector2f center, sf::Vector2f velocity, float radius, const Wall& wall, float maxTime, float& time, sf::Vector2f& normal) {
+    const float reach = radius + Wall::thickness / 2;
+    sf::Vector2f edge = wall.end - wall.start;
+    float lengthSquared = edge.x * edge.x + edge.y * edge.y;
+
+    // Already touching: bounce now if moving into the wall. A ball moving away cannot hit it again since the capsule is convex.
+    float closestAlong = lengthSquared > 0 ? std::clamp(((center.x - wall.start.x) * edge.x + (center.y - wall.start.y) * edge.y) / lengthSquared, 0.0f, 1.0f) : 0.0f;
+    sf::Vector2f fromClosest = center - (wall.start + edge * closestAlong);
+    if (fromClosest.x * fromClosest.x + fromClosest.y * fromClosest.y <= reach * reach) {
+        normal = wallContactNormal(center, wall, velocity);
+        time = 0;
+        return velocity.x * normal.x + velocity.y * normal.y < 0;
+    }
+
+    bool hit = false;
+    time = maxTime;
+
+    // Flat sides of the capsule
+    if (lengthSquared > 0) {
+        float length = std::sqrt(lengthSquared);
+        sf::Vector2f wallNormal(-edge.y / length, edge.x / length);
+        sf::Vector2f offset = center - wall.start;
+        float distance = offset.x * wallNormal.x + offset.y * wallNormal.y;
+        float side = distance >= 0 ? 1.0f : -1.0f;
+        float closingSpeed = -(velocity.x * wallNormal.x + velocity.y * wallNormal.y) * side;
+        if (closingSpeed > 0) {
+            // A center already within reach of the line lies past one of the ends, so only the rounded ends can be hit
+            float t = (std::abs(distance) - reach) / closingSpeed;
+            sf::Vector2f contact = offset + velocity * t;
+            float along = (contact.x * edge.x + contact.y * edge.y) / lengthSquared;
+            if (t >= 0 && t <= time && along >= 0 && along <= 1) {
+                time = t;
+                normal = wallNormal * side;
+                hit = true;
+            }
+        }
+    }
+
+    // Rounded ends of the capsule
+    const float speedSquared = velocity.x * velocity.x + velocity.y * velocity.y;
+    for (const sf::Vector2f& endPoint : { wall.start, wall.end }) {
+        sf::Vector2f offset = center - endPoint;
+        float approach = offset.x * velocity.x + offset.y * velocity.y;
+        if (approach >= 0 || speedSquared == 0) {
+            continue; // Moving away from this end
+        }
+        float excess = offset.x * offset.x + offset.y * offset.y - reach * reach;
+        float discriminant = approach * approach - speedSquared * excess;
+        if (discriminant < 0) {
+            continue;
+        }
+        float t = (-approach - std::sqrt(discriminant)) / speedSquared;
+        if (t <= time && (!hit || t < time)) {
+            sf::Vector2f contact = offset + velocity * t;
+            float contactLength = std::sqrt(contact.x * contact.x + contact.y * contact.y);
+            if (contactLength == 0) {
+                continue;
+            }
+            time = t;
+            normal = contact / contactLength;
+            hit = true;
+        }
+    }
+
+    return hit;
+}
+
+// Unit normal at the point of the wall closest to the ball's center, pointing towards the ball. Used to bounce a ball that touches the wall, so the bounce and the touching test in sweptCircleWallHit always agree; falls back to the wall's own normal facing against the velocity if the center is on the wall.
+sf::Vector2f wallContactNormal(sf::Vector2f center, const Wall& wall, sf::Vector2f velocity) {
+    sf::Vector2f edge = wall.end - wall.start;
+    float lengthSquared = edge.x * edge.x + edge.y * edge.y;
+    float along = lengthSquared > 0 ? std::clamp(((center.x - wall.start.x) * edge.x + (center.y - wall.start.y) * edge.y) / lengthSquared, 0.0f, 1.0f) : 0.0f;
+    sf::Vector2f offset = center - (wall.start + edge * along);
+    float length = std::sqrt(offset.x * offset.x + offset.y * offset.y);
+    if (length > 0) {
+        return offset / length;
+    }
+    sf::Vector2f normal = getWallCollision(wall);
+    return (normal.x * velocity.x + normal.y * velocity.y) > 0 ? -normal : normal;
+}
+
+// Finds the first wall a ball of the given radius touches while its center moves at velocity for up to maxTime, using the broadphase to skip walls far from its path. On a hit, returns the time of contact and the contact normal.
+// Candidates are collected into blocks of wallBlockSize and tested together by sweepWallBlock, and only the normal of the wall that is hit first is computed. The scalar level goes through the same blocks, so it finds the same wall at the same time as the SIMD levels.
+bool findWallHit(sf::Vector2f center, sf::Vector2f velocity, float radius, float maxTime, const std::vector<Wall>& walls, const WallBroadphase& broadphase, SimdLevel simd, float& time, sf::Vector2f& normal) {
+    bool hit = false;
+    time = maxTime;
+    const SweptBall ball(center, velocity, radius);
+    uint32_t block[wallBlockSize];
+    size_t blockCount = 0;
+    uint32_t hitWall = 0;
+    broadphase.forEachCandidate(center, center + velocity * maxTime, ball.reach, [&](uint32_t wallIndex) {
+        block[blockCount++] = wallIndex;
+        if (blockCount == wallBlockSize) {
+            sweepWallBlock(broadphase.table, block, blockCount, ball, simd, time, hitWall, hit);
+            blockCount = 0;
+        }
+        });
+    if (blockCount > 0) {
+        sweepWallBlock(broadphase.table, block, blockCount, ball, simd, time, hitWall, hit);
+    }
+    if (hit) {
+        normal = wallContactNormal(center + velocity * time, walls[hitWall], velocity);
+    }
+    return hit;
+}
+
+// Updates the position of particle i and checks for boundary and wall collisions.
+// Walls are handled with continuous collision detection: the ball is moved to the exact time it touches a wall, bounced, and continues with the rest of the step, up to maxWallBounces times per step. Since the wall's thickness and the ball's radius are taken into account, fast balls cannot skip through walls at any step size.
+// With a lookahead, the wall search also covers that much time past the end of the step, and the time the ball can keep going before it hits a wall is returned (at most lookahead; 0 if it bounced off the boundary, which turns it around).
+// With events, every change of course is added to them: a wall bounce at the time of contact, a boundary bounce and a wedged ball at the end of the step, where they are put.
+float updateBall(ParticleStore& particles, size_t i, const sf::FloatRect& boundary, const std::vector<Wall>& walls, const WallBroadphase& broadphase, float deltaTime, SimdLevel simd, std::vector<ParticleEvent>* events, float lookahead) {
+    float& vx = particles.vx[i];
+    float& vy = particles.vy[i];
+    float radius = particles.radius[i];
+
+    // Positions are the top-left corner of the ball; collision works on its center
+    sf::Vector2f center(particles.x[i] + radius, particles.y[i] + radius);
+    sf::Vector2f velocity(vx, vy);
+    float remaining = deltaTime;
+    float clearTime = lookahead;
+    bool wedged = false;
+    for (int bounce = 1; remaining > 0; ++bounce) {
+        float hitTime = remaining + lookahead;
+        sf::Vector2f hitNormal;
+        bool hit = !walls.empty() && findWallHit(center, velocity, radius, remaining + lookahead, walls, broadphase, simd, hitTime, hitNormal);
+        if (!hit || hitTime > remaining) {
+            center += velocity * remaining;
+            clearTime = hit ? hitTime - remaining : lookahead;
+            break;
+        }
+        center += velocity * hitTime;
+        velocity = reflect(velocity, hitNormal);
+        remaining -= hitTime;
+        if (events != nullptr) {
+            events->push_back({ static_cast<uint32_t>(i), -remaining, center.x - radius, center.y - radius, velocity.x, velocity.y });
+        }
+        if (bounce == maxWallBounces) {
+            clearTime = 0;
+            wedged = remaining > 0;
+            break; // Wedged between walls; the rest of the step is dropped
+        }
+    }
+    vx = velocity.x;
+    vy = velocity.y;
+    sf::Vector2f endPosition(center.x - radius, center.y - radius);
+
+    // Check boundary collision with adjusted ball radius
+    float leftBound = boundary.left + radius;
+    float rightBound = boundary.left + boundary.width - radius * 2;
+    float topBound = boundary.top + radius;
+    float bottomBound = boundary.top + boundary.height - radius * 2;
+
+    bool bounced = false;
+    if (endPosition.x < leftBound || endPosition.x > rightBound) {
+        vx = -vx; // Reverse horizontal velocity
+        endPosition.x = (endPosition.x < leftBound) ? leftBound : rightBound;
+        clearTime = 0;
+        bounced = true;
+    }
+
+    if (endPosition.y < topBound || endPosition.y > bottomBound) {
+        vy = -vy; // Reverse vertical velocity
+        endPosition.y = (endPosition.y < topBound) ? topBound : bottomBound;
+        clearTime = 0;
+        bounced = true;
+    }
+
+    particles.x[i] = endPosition.x; // Move the ball to its new position
+    particles.y[i] = endPosition.y;
+    if (events != nullptr && (bounced || wedged)) {
+        events->push_back({ static_cast<uint32_t>(i), 0.0f, endPosition.x, endPosition.y, vx, vy });
+    }
+    return clearTime;
+}
+
+// Updates the positions of all Ball objects in parallel on the shared thread pool to handle a large numbers of balls efficiently.
+// Without walls only the boundary can be hit, so each chunk goes through the vectorized integrateBalls kernel instead of updateBall.
+// With the linear broadphase and SIMD, every ball tests every wall, so blocks of balls are first swept against the whole wall table by sweepBallBlock. Balls that touch no wall in the step move as updateBall moves them without walls, which is what it would have done anyway; only the others run its wall search.
+// With an event log, the bounces are reported to it.
+void updateBallsInParallel(ParticleStore& particles, const sf::FloatRect& boundary, const std::vector<Wall>& walls, const WallBroadphase& broadphase, float deltaTime, ThreadPool& pool, SimdLevel simd, EventLog* log) {
+    pool.parallelFor(0, particles.size(), physicsGrainSize, [&particles, &boundary, &walls, &broadphase, deltaTime, simd, log](size_t startIdx, size_t endIdx) {
+        std::vector<ParticleEvent> found;
+        std::vector<ParticleEvent>* events = log != nullptr ? &found : nullptr;
+        if (walls.empty()) {
+            integrateBalls(particles, startIdx, endIdx, boundary, deltaTime, simd, events);
+        }
+        else if (broadphase.mode == BroadphaseMode::Linear && simd != SimdLevel::Scalar) {
+            const std::vector<Wall> noWalls;
+            for (size_t j = startIdx; j < endIdx;) {
+                size_t count = std::min({ wallBlockSize, endIdx - j, ChunkedArray<float>::chunkEnd(j) - j });
+                uint32_t touching = sweepBallBlock(broadphase.table, particles, j, count, deltaTime, simd);
+                for (size_t lane = 0; lane < count; ++lane) {
+                    updateBall(particles, j + lane, boundary, (touching >> lane) & 1 ? walls : noWalls, broadphase, deltaTime, simd, events);
+                }
+                j += count;
+            }
+        }
+        else {
+            for (size_t j = startIdx; j < endIdx; ++j) {
+                updateBall(particles, j, boundary, walls, broadphase, deltaTime, simd, events);
+            }
+        }
+        if (log != nullptr) {
+            log->add(found);
+        }
+        });
+}
+
+// Applies an elastic collision between balls i and j if they touch and are moving towards each other. Returns whether they did.
+bool collideBalls(ParticleStore& particles, uint32_t i, uint32_t j) {
+    float dx = (particles.x[j] + particles.radius[j]) - (particles.x[i] + particles.radius[i]);
+    float dy = (particles.y[j] + particles.radius[j]) - (particles.y[i] + particles.radius[i]);
+    float distanceSquared = dx * dx + dy * dy;
+    float touchDistance = particles.radius[i] + particles.radius[j];
+    if (distanceSquared >= touchDistance * touchDistance || distanceSquared == 0) {
+        return false;
+    }
+
+    // Only balls moving towards each other collide, so overlapping balls that are already separating are left alone
+    float approach = (particles.vx[j] - particles.vx[i]) * dx + (particles.vy[j] - particles.vy[i]) * dy;
+    if (approach >= 0) {
+        return false;
+    }
+
+    float impulse = 2 * approach / ((particles.mass[i] + particles.mass[j]) * distanceSquared);
+    particles.vx[i] += impulse * particles.mass[j] * dx;
+    particles.vy[i] += impulse * particles.mass[j] * dy;
+    particles.vx[j] -= impulse * particles.mass[i] * dx;
+    particles.vy[j] -= impulse * particles.mass[i] * dy;
+    return true;
+}
+
+// Bounces touching balls off each other with elastic collisions, using the ball grid to find touching pairs.
+// Each cell handles the pairs inside it and with its right and lower neighbours, which changes balls in a 3 x 2 block of cells. Cells are processed in six passes (every third column, every second row) so cells in the same pass never share a ball, which lets them run in parallel while each pair is still resolved one at a time and conserves momentum and energy.
+// With an event log, every ball that collided is reported to it once, after the last pass, at eventTime: the start of the step counted from its end.
+void resolveBallCollisions(ParticleStore& particles, const sf::FloatRect& area, BallGrid& ballGrid, ThreadPool& pool, EventLog* log, float eventTime) {
+    if (particles.size() < 2) {
+        return;
+    }
+
+    ballGrid.build(particles, area, pool);
+    const int columns = ballGrid.getColumns();
+    const int rows = ballGrid.getRows();
+    uint8_t* collided = ballGrid.collidedFlags();
+    std::vector<uint32_t> reported; // Balls that collided in any pass, once each, while recording
+    std::mutex reportedMutex;
+
+    for (int pass = 0; pass < 6; ++pass) {
+        const int firstColumn = pass % 3;
+        const int firstRow = pass / 3;
+        const int passColumns = (columns - firstColumn + 2) / 3;
+        const int passRows = (rows - firstRow + 1) / 2;
+        if (passColumns <= 0 || passRows <= 0) {
+            continue;
+        }
+
+        pool.parallelFor(0, static_cast<size_t>(passColumns) * passRows, collisionGrainSize, [&](size_t startIdx, size_t endIdx) {
+            std::vector<uint32_t> touched; // Balls that collided for the first time this step, while recording
+            auto collide = [&](uint32_t a, uint32_t b) {
+                if (collideBalls(particles, a, b) && log != nullptr) {
+                    // Balls of cells in the same pass are never shared, so no other work item marks these now
+                    for (uint32_t ball : { a, b }) {
+                        if (!collided[ball]) {
+                            collided[ball] = 1;
+                            touched.push_back(ball);
+                        }
+                    }
+                }
+            };
+            for (size_t k = startIdx; k < endIdx; ++k) {
+                int column = firstColumn + static_cast<int>(k % passColumns) * 3;
+                int row = firstRow + static_cast<int>(k / passColumns) * 2;
+                const uint32_t* begin = ballGrid.cellBegin(column, row);
+                const uint32_t* end = ballGrid.cellEnd(column, row);
+                if (begin == end) {
+                    continue;
+                }
+
+                // Pairs inside the cell
+                for (const uint32_t* a = begin; a != end; ++a) {
+                    for (const uint32_t* b = a + 1; b != end; ++b) {
+                        collide(*a, *b);
+                    }
+                }
+
+                // Pairs with the right, lower-left, lower and lower-right neighbours; the other four neighbours own their pairs with this cell
+                const int neighbours[4][2] = { { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } };
+                for (const auto& offset : neighbours) {
+                    int neighbourColumn = column + offset[0];
+                    int neighbourRow = row + offset[1];
+                    if (neighbourColumn < 0 || neighbourColumn >= columns || neighbourRow >= rows) {
+                        continue;
+                    }
+                    const uint32_t* neighbourBegin = ballGrid.cellBegin(neighbourColumn, neighbourRow);
+                    const uint32_t* neighbourEnd = ballGrid.cellEnd(neighbourColumn, neighbourRow);
+                    for (const uint32_t* a = begin; a != end; ++a) {
+                        for (const uint32_t* b = neighbourBegin; b != neighbourEnd; ++b) {
+                            collide(*a, *b);
+                        }
+                    }
+                }
+            }
+            if (!touched.empty()) {
+                std::lock_guard<std::mutex> lock(reportedMutex);
+                reported.insert(reported.end(), touched.begin(), touched.end());
+            }
+            });
+    }
+
+    if (reported.empty()) {
+        return;
+    }
+    // A ball may collide several times; only its velocity after the last collision is reported
+    pool.parallelFor(0, reported.size(), physicsGrainSize, [&](size_t first, size_t last) {
+        std::vector<ParticleEvent> found;
+        found.reserve(last - first);
+        for (size_t k = first; k < last; ++k) {
+            uint32_t i = reported[k];
+            found.push_back({ i, eventTime, particles.x[i], particles.y[i], particles.vx[i], particles.vy[i] });
+            collided[i] = 0;
+        }
+        log->add(found);
+        });
+}
+
+// Runs of consecutive particles that survive a compaction, within one chunk
+struct KeptRun {
+    size_t first;
+    size_t count;
+};
+
+// Copies the kept runs of the chunks from firstChunk on into spare, each chunk at the place the prefix sum gave it (counted from the start of firstChunk), in parallel; spare then takes the place of those chunks.
+template <typename T>
+static void compactArray(ChunkedArray<T>& values, ChunkedArray<T>& spare, size_t firstChunk, const std::vector<size_t>& destination, const std::vector<std::vector<KeptRun>>& runs, size_t kept, ThreadPool& pool) {
+    size_t tailStart = firstChunk * compactGrainSize;
+    spare.resizeForOverwrite(kept - tailStart);
+    pool.parallelFor(firstChunk, destination.size(), 1, [&](size_t first, size_t last) {
+        for (size_t chunk = first; chunk < last; ++chunk) {
+            size_t target = destination[chunk] - tailStart;
+            for (const KeptRun& run : runs[chunk]) {
+                values.copyTo(spare, run.first, target, run.count);
+                target += run.count;
+            }
+        }
+        });
+    values.replaceFrom(tailStart, spare);
+}
+
+// Drops the particles marked by ParticleStore::remove and moves the rest together, keeping their order. Every chunk lists its runs of survivors in parallel, and an exclusive prefix sum over the survivor counts gives the index each chunk's survivors start at. The chunks before the first removal stay where they are; the runs of the others are scattered in parallel into spare chunks, one array at a time, which then replace the old ones, so no work item reads what another one writes. The handle slots of the moved particles are pointed at their new indices at the end.
+void compactParticles(ParticleStore& particles, ThreadPool& pool) {
+    if (particles.removedCount == 0) {
+        return;
+    }
+    size_t count = particles.size();
+    size_t chunkCount = (count + compactGrainSize - 1) / compactGrainSize;
+    std::vector<size_t> destination(chunkCount);
+    std::vector<std::vector<KeptRun>> runs(chunkCount);
+    pool.parallelFor(0, chunkCount, 1, [&](size_t firstChunk, size_t lastChunk) {
+        for (size_t chunk = firstChunk; chunk < lastChunk; ++chunk) {
+            size_t end = std::min((chunk + 1) * compactGrainSize, count);
+            size_t kept = 0;
+            for (size_t i = chunk * compactGrainSize; i < end;) {
+                if (particles.isRemoved(i)) {
+                    ++i;
+                    continue;
+                }
+                size_t runEnd = i + 1;
+                while (runEnd < end && !particles.isRemoved(runEnd)) {
+                    ++runEnd;
+                }
+                runs[chunk].push_back({ i, runEnd - i });
+                kept += runEnd - i;
+                i = runEnd;
+            }
+            destination[chunk] = kept;
+        }
+        });
+
+    size_t kept = 0;
+    size_t firstChunk = chunkCount;
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+        size_t chunkKept = destination[chunk];
+        destination[chunk] = kept;
+        if (firstChunk == chunkCount && chunkKept < std::min(compactGrainSize, count - chunk * compactGrainSize)) {
+            firstChunk = chunk;
+        }
+        kept += chunkKept;
+    }
+
+    ChunkedArray<float> spareFloats;
+    for (ChunkedArray<float>* values : { &particles.x, &particles.y, &particles.vx, &particles.vy, &particles.radius, &particles.mass }) {
+        compactArray(*values, spareFloats, firstChunk, destination, runs, kept, pool);
+    }
+    ChunkedArray<uint32_t> spareWords;
+    compactArray(particles.color, spareWords, firstChunk, destination, runs, kept, pool);
+    compactArray(particles.slot, spareWords, firstChunk, destination, runs, kept, pool);
+    particles.removedCount = 0;
+    ++particles.layoutVersion;
+    ++particles.reorderVersion;
+
+    pool.parallelFor(firstChunk * compactGrainSize, kept, compactGrainSize, [&particles](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            particles.slotIndex[particles.slot[i]] = static_cast<uint32_t>(i);
+        }
+        });
+}
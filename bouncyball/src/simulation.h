@@ -0,0 +1,2713 @@
+#pragma once
+
+// Simulation core: particles, walls and the engines that move them. Nothing here opens a window or links against the
+// SFML graphics library; only the header-only sf::Vector2 and sf::Rect are used, so the core also runs headless.
+
+#include <SFML/System/Vector2.hpp>
+#include <SFML/Graphics/Rect.hpp>
+#include <vector>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <cstdint>
+#include <queue>
+#include <limits>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <cstdio>
+#include <optional>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX() std::this_thread::yield()
+#endif
+
+constexpr float pi = 3.14159265358979323846f; // Not M_PI, which only some standard libraries define
+
+// Size of the simulated area in pixels
+const unsigned int SIMULATION_WIDTH = 1280;
+const unsigned int SIMULATION_HEIGHT = 720;
+
+// Class declarations
+class Wall;
+class Ball;
+template <typename T> class ChunkedArray;
+class ParticleStore;
+struct ParticleHandle;
+struct SpawnBatch;
+class ThreadPool;
+class WallTable;
+struct SweptBall;
+class WallGrid;
+class WallBvh;
+class WallBroadphase;
+class BallGrid;
+class EventEngine;
+class UpdateScheduler;
+class CommandQueue;
+class MappedFile;
+class EventLog;
+struct TrajectoryFrame;
+struct TrajectoryEncoder;
+struct TrajectoryIndexEntry;
+struct ParticleEvent;
+struct EventBatch;
+struct EventSegment;
+struct EventIndex;
+class TrajectoryRecorder;
+class EventRecorder;
+struct Scenario;
+class TrajectoryPlayer;
+class Simulation;
+
+// SIMD Level
+// Instruction sets the vectorized kernels (integrateBalls, sweepWallBlock, sweepBallBlock, spawnBalls) can run on. bestSimdLevel() picks the widest one the CPU supports; the scalar code runs everywhere.
+enum class SimdLevel {
+    Scalar,
+    Avx2,
+    Avx512
+};
+
+// Function declarations
+sf::Vector2f reflect(const sf::Vector2f& velocity, const sf::Vector2f& normal);
+sf::Vector2f getWallCollision(const Wall& wall);
+bool sweptCircleWallHit(sf::Vector2f center, sf::Vector2f velocity, float radius, const Wall& wall, float maxTime, float& time, sf::Vector2f& normal);
+sf::Vector2f wallContactNormal(sf::Vector2f center, const Wall& wall, sf::Vector2f velocity);
+bool findWallHit(sf::Vector2f center, sf::Vector2f velocity, float radius, float maxTime, const std::vector<Wall>& walls, const WallBroadphase& broadphase, SimdLevel simd, float& time, sf::Vector2f& normal);
+float updateBall(ParticleStore& particles, size_t i, const sf::FloatRect& boundary, const std::vector<Wall>& walls, const WallBroadphase& broadphase, float deltaTime, SimdLevel simd, std::vector<ParticleEvent>* events = nullptr, float lookahead = 0.0f);
+void updateBallsInParallel(ParticleStore& particles, const sf::FloatRect& boundary, const std::vector<Wall>& walls, const WallBroadphase& broadphase, float deltaTime, ThreadPool& pool, SimdLevel simd, EventLog* log = nullptr);
+SimdLevel bestSimdLevel();
+const char* getSimdLevelName(SimdLevel simd);
+void integrateBalls(ParticleStore& particles, size_t first, size_t last, const sf::FloatRect& boundary, float deltaTime, SimdLevel simd, std::vector<ParticleEvent>* events = nullptr);
+void sweepWallBlock(const WallTable& table, const uint32_t* wallIndices, size_t count, const SweptBall& ball, SimdLevel simd, float& time, uint32_t& hitWall, bool& hit);
+uint32_t sweepBallBlock(const WallTable& table, const ParticleStore& particles, size_t first, size_t count, float maxTime, SimdLevel simd);
+void spawnBalls(ParticleStore& particles, size_t at, const SpawnBatch& batch, size_t first, size_t last, SimdLevel simd);
+bool collideBalls(ParticleStore& particles, uint32_t i, uint32_t j);
+void resolveBallCollisions(ParticleStore& particles, const sf::FloatRect& area, BallGrid& ballGrid, ThreadPool& pool, EventLog* log = nullptr, float eventTime = 0.0f);
+void compactParticles(ParticleStore& particles, ThreadPool& pool);
+bool saveSnapshot(Simulation& simulation, const std::string& path);
+bool loadSnapshot(Simulation& simulation, const std::string& path);
+std::FILE* openTrajectoryFile(const std::string& path, size_t interval);
+bool writeTrajectoryFrame(std::FILE* file, const TrajectoryFrame& frame, TrajectoryEncoder& encoder);
+bool writeTrajectoryIndex(std::FILE* file, const TrajectoryEncoder& encoder);
+bool readTrajectoryIndex(const std::string& path, const MappedFile& file, std::vector<TrajectoryIndexEntry>& index, float& positionScale, float& velocityScale);
+void decodeTrajectoryBlock(const MappedFile& file, const TrajectoryIndexEntry& frame, size_t block, int64_t* x, int64_t* y, int64_t* vx, int64_t* vy, ParticleStore& particles);
+std::FILE* openEventFile(const std::string& path);
+bool writeEventBatch(std::FILE* file, const EventBatch& batch);
+bool isEventFile(const MappedFile& file);
+bool readEventSegments(const std::string& path, const MappedFile& file, std::vector<EventSegment>& segments);
+void indexEventSegment(const MappedFile& file, const EventSegment& segment, EventIndex& index);
+bool readScenario(const std::string& path, Scenario& scenario);
+void applyScenario(Simulation& simulation, const Scenario& scenario);
+bool importParticles(Simulation& simulation, const std::string& path, float radius, std::uint32_t color);
+
+// Tuning
+const float wallGridCellSize = 32.0f; // Side length of a wall grid cell in pixels
+const unsigned int workerSpinCount = 20000; // Spin iterations before an idle worker goes to sleep
+const size_t physicsGrainSize = 512; // Balls per parallel work item, small enough for work stealing to even out the threads
+const int maxWallBounces = 4; // Wall bounces a ball can make within one physics step
+const size_t collisionGrainSize = 64; // Ball grid cells per parallel work item
+const int maxUpdateCadence = 8; // Most steps the update scheduler lets a ball go without moving it
+const float maxLagDistance = 2.0f; // How far in pixels a ball may be behind its true position while the update scheduler skips it
+const size_t wallBlockSize = 8; // Candidate walls sweepWallBlock tests at once, and balls sweepBallBlock tests at once
+const size_t spawnGrainSize = 16384; // Balls of a spawn batch per parallel work item
+const size_t particleChunkSize = size_t(1) << 14; // Particles per chunk of the particle arrays (ChunkedArray); a multiple of physicsGrainSize, so physics work items never straddle two chunks
+const size_t compactGrainSize = particleChunkSize; // Particles per parallel work item of compactParticles, one chunk each
+static_assert(particleChunkSize % physicsGrainSize == 0, "physics work items must not straddle particle chunks");
+const size_t spawnSliceSize = 1 << 20; // Balls of spawn batches a step adds at most, so huge batches come alive over several frames
+const size_t recorderRingSize = 4; // Captured frames that can wait for the trajectory writer before new ones are dropped
+const size_t recorderKeyframeInterval = 60; // Frames between two trajectory frames stored in full instead of as changes, so a player can start reading there
+const size_t trajectoryBlockSize = particleChunkSize; // Particles per independently decodable block of a trajectory frame; one chunk of the particle arrays
+const size_t importGrainSize = size_t(1) << 20; // Bytes of a CSV particle import per parallel work item
+const size_t eventQueueBytes = size_t(64) << 20; // Bytes of captured event records that may wait for the event writer; a step that would exceed it waits until the writer caught up
+
+// Wall Class
+// Represents a wall in the simulation, defined by start and end points. Collision treats it as a capsule Wall::thickness wide, the same width it is drawn with.
+class Wall {
+public:
+    static constexpr float thickness = 2.0f; // Drawn thickness, also used for collision
+
+    sf::Vector2f start;
+    sf::Vector2f end;
+
+    Wall(sf::Vector2f start, sf::Vector2f end) : start(start), end(end) {}
+};
+
+// Ball Class
+// Describes a single particle to be spawned: its position (top-left of the circle's bounding box), velocity, radius and color. Balls are only used to build particles; live particles are kept in the ParticleStore.
+class Ball {
+public:
+    float x, y;
+    float vx, vy;
+    float radius;
+    float mass;
+    std::uint32_t color; // RGBA packed as by sf::Color::toInteger
+
+    Ball(float x, float y, float radius, std::uint32_t color, float speed, float angleInDegrees, float mass = 1.0f)
+        : radius(radius), mass(mass), color(color) {
+        float invertedY = SIMULATION_HEIGHT - y;
+
+        // Adjust for radius to ensure the ball spawns from the correct location
+        this->x = x;
+        this->y = invertedY - radius * 2;
+
+        // Convert angle from degrees to radians
+        float angleInRadians = angleInDegrees * (pi / 180.0f);
+
+        // Calculate velocity components based on speed and angle
+        vx = speed * std::cos(angleInRadians);
+        vy = -speed * std::sin(angleInRadians);
+    }
+};
+
+// Spawn Batch Struct
+// A line of balls as the sidebar forms create them: ball i of count gets the position, angle and speed interpolated between the start and end values at t = i / (count - 1), and is otherwise built like a Ball. Only this description is posted; the balls are generated in parallel straight into the particle store.
+struct SpawnBatch {
+    size_t count = 0;
+    sf::Vector2f startPosition; // As passed to Ball: y measured from the bottom
+    sf::Vector2f endPosition;
+    float startAngle = 0; // Degrees
+    float endAngle = 0;
+    float startSpeed = 0;
+    float endSpeed = 0;
+    float radius = 3.0f;
+    float mass = 1.0f;
+    std::uint32_t color = 0;
+};
+
+// Chunked Array Class
+// Growable array for per-particle data, made of fixed-size chunks of particleChunkSize elements. Growing only allocates new chunks and never moves the elements already stored, so crossing the capacity costs one allocation instead of a copy of the whole array, and pointers into the array stay valid. Elements are contiguous within a chunk; kernels that work through pointers take one chunk at a time (see chunkEnd).
+// New elements are zero-initialized, as with std::vector::resize. Shrinking keeps the chunks for later growth.
+template <typename T>
+class ChunkedArray {
+public:
+    static constexpr size_t chunkShift = 14;
+    static constexpr size_t chunkSize = size_t(1) << chunkShift;
+    static_assert(chunkSize == particleChunkSize, "chunkShift must match particleChunkSize");
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    size_t capacity() const {
+        return chunks.size() * chunkSize;
+    }
+
+    void reserve(size_t newCapacity) {
+        while (capacity() < newCapacity) {
+            chunks.emplace_back(new T[chunkSize]);
+        }
+    }
+
+    void resize(size_t newSize, const T& value = T()) {
+        reserve(newSize);
+        for (size_t i = count; i < newSize; i = chunkEnd(i)) {
+            std::fill(pointer(i), pointer(i) + (std::min(chunkEnd(i), newSize) - i), value);
+        }
+        count = newSize;
+    }
+
+    // Like resize, but leaves the new elements uninitialized for a caller that overwrites all of them.
+    void resizeForOverwrite(size_t newSize) {
+        reserve(newSize);
+        count = newSize;
+    }
+
+    void clear() {
+        count = 0;
+    }
+
+    void push_back(const T& value) {
+        reserve(count + 1);
+        (*this)[count++] = value;
+    }
+
+    T& operator[](size_t i) {
+        return chunks[i >> chunkShift][i & (chunkSize - 1)];
+    }
+
+    const T& operator[](size_t i) const {
+        return chunks[i >> chunkShift][i & (chunkSize - 1)];
+    }
+
+    // Address of element i; the elements after it are contiguous up to chunkEnd(i).
+    T* pointer(size_t i) {
+        return &(*this)[i];
+    }
+
+    const T* pointer(size_t i) const {
+        return &(*this)[i];
+    }
+
+    // First index past the chunk that holds element i.
+    static size_t chunkEnd(size_t i) {
+        return (i | (chunkSize - 1)) + 1;
+    }
+
+    // Copies elements source to source + length - 1 to element target onwards of other, which must already exist, chunk piece by chunk piece.
+    void copyTo(ChunkedArray& other, size_t source, size_t target, size_t length) const {
+        while (length > 0) {
+            size_t piece = std::min({ length, chunkEnd(target) - target, chunkEnd(source) - source });
+            std::copy(pointer(source), pointer(source) + piece, other.pointer(target));
+            target += piece;
+            source += piece;
+            length -= piece;
+        }
+    }
+
+    // Replaces the elements from first on, which must be the start of a chunk, with the elements of other by exchanging chunks instead of copying them. other is left holding the replaced chunks, to be reused.
+    void replaceFrom(size_t first, ChunkedArray& other) {
+        reserve(first + other.count);
+        for (size_t chunk = first >> chunkShift, otherChunk = 0; chunk < chunks.size() && otherChunk < other.chunks.size(); ++chunk, ++otherChunk) {
+            chunks[chunk].swap(other.chunks[otherChunk]);
+        }
+        count = first + other.count;
+        other.count = 0;
+    }
+
+private:
+    std::vector<std::unique_ptr<T[]>> chunks;
+    size_t count = 0;
+};
+
+// Particle Handle Struct
+// Stable reference to one particle, see ParticleStore.
+struct ParticleHandle {
+    uint32_t slot = 0xFFFFFFFF;
+    uint32_t generation = 0;
+};
+
+// Particle Store Class
+// Holds the state of every particle in structure-of-arrays form. Positions and velocities live in their own contiguous arrays so the physics step only streams the floats it reads and writes; radius, mass and color are kept apart since only collision and drawing need them.
+// The arrays are ChunkedArrays, so adding particles never moves the ones already stored.
+// Particles can be removed: remove() only marks a particle, and compactParticles later moves the survivors together in their original order, so the arrays stay dense for the kernels. Code outside the simulation refers to particles by ParticleHandle, which stays valid while the particle moves through compactions and goes stale once it is removed, even if its slot is reused.
+class ParticleStore {
+public:
+    static constexpr uint32_t noSlot = 0xFFFFFFFF;
+
+    ChunkedArray<float> x;
+    ChunkedArray<float> y;
+    ChunkedArray<float> vx;
+    ChunkedArray<float> vy;
+    ChunkedArray<float> radius;
+    ChunkedArray<float> mass;
+    ChunkedArray<std::uint32_t> color;
+    ChunkedArray<uint32_t> slot; // Handle slot of each particle; noSlot once removed
+    float maxRadius = 0; // Largest radius in the store, sizes the ball collision cells
+    size_t removedCount = 0; // Removed particles not compacted away yet
+    uint64_t layoutVersion = 0; // Bumped whenever particles are added, dropped or moved to other indices
+    uint64_t reorderVersion = 0; // Bumped whenever particles are dropped or moved to other indices; adding particles at the end leaves it
+
+    // Handle slots: the particle index each slot points to, and a generation that is bumped whenever the slot's particle is removed
+    std::vector<uint32_t> slotIndex;
+    std::vector<uint32_t> slotGeneration;
+    std::vector<uint32_t> freeSlots;
+
+    size_t size() const {
+        return x.size();
+    }
+
+    bool empty() const {
+        return x.empty();
+    }
+
+    void reserve(size_t count) {
+        x.reserve(count);
+        y.reserve(count);
+        vx.reserve(count);
+        vy.reserve(count);
+        radius.reserve(count);
+        mass.reserve(count);
+        color.reserve(count);
+        slot.reserve(count);
+    }
+
+    ParticleHandle push_back(const Ball& ball) {
+        x.push_back(ball.x);
+        y.push_back(ball.y);
+        vx.push_back(ball.vx);
+        vy.push_back(ball.vy);
+        radius.push_back(ball.radius);
+        mass.push_back(ball.mass);
+        color.push_back(ball.color);
+        slot.push_back(allocateSlot(static_cast<uint32_t>(size() - 1)));
+        maxRadius = std::max(maxRadius, ball.radius);
+        ++layoutVersion;
+        return handle(size() - 1);
+    }
+
+    // Makes room for count more balls.
+    void reserveMore(size_t count) {
+        reserve(size() + count);
+    }
+
+    // Adds many balls at once: the arrays grow once and the balls are written straight into them.
+    void append(const std::vector<Ball>& balls) {
+        if (balls.empty()) {
+            return;
+        }
+        size_t at = size();
+        float largest = 0;
+        for (const Ball& ball : balls) {
+            largest = std::max(largest, ball.radius);
+        }
+        grow(balls.size(), largest);
+        for (size_t k = 0; k < balls.size(); ++k) {
+            const Ball& ball = balls[k];
+            size_t i = at + k;
+            x[i] = ball.x;
+            y[i] = ball.y;
+            vx[i] = ball.vx;
+            vy[i] = ball.vy;
+            radius[i] = ball.radius;
+            mass[i] = ball.mass;
+            color[i] = ball.color;
+        }
+    }
+
+    // Adds count balls to be filled in by the caller, e.g. by spawnBalls; until then their values are undefined. Their radius counts towards maxRadius right away.
+    void grow(size_t count, float newRadius) {
+        reserveMore(count);
+        size_t oldSize = size();
+        size_t newSize = oldSize + count;
+        x.resizeForOverwrite(newSize);
+        y.resizeForOverwrite(newSize);
+        vx.resizeForOverwrite(newSize);
+        vy.resizeForOverwrite(newSize);
+        radius.resizeForOverwrite(newSize);
+        mass.resizeForOverwrite(newSize);
+        color.resizeForOverwrite(newSize);
+        slot.resizeForOverwrite(newSize);
+        for (size_t i = oldSize; i < newSize; ++i) {
+            slot[i] = allocateSlot(static_cast<uint32_t>(i));
+        }
+        maxRadius = std::max(maxRadius, newRadius);
+        ++layoutVersion;
+    }
+
+    // Removes every particle. Their handles go stale like those of removed particles.
+    void clear() {
+        for (size_t i = 0; i < size(); ++i) {
+            remove(i);
+        }
+        x.clear();
+        y.clear();
+        vx.clear();
+        vy.clear();
+        radius.clear();
+        mass.clear();
+        color.clear();
+        slot.clear();
+        maxRadius = 0;
+        removedCount = 0;
+        ++layoutVersion;
+        ++reorderVersion;
+    }
+
+    // Drops the particles from index count on, e.g. balls just added that turn out to be invalid. Their handles go stale like those of removed particles. maxRadius is left as it is.
+    void truncate(size_t count) {
+        if (count >= size()) {
+            return;
+        }
+        for (size_t i = count; i < size(); ++i) {
+            // A dropped particle no longer waits for compactParticles, whether it was removed before or not
+            remove(i);
+            --removedCount;
+        }
+        x.resizeForOverwrite(count);
+        y.resizeForOverwrite(count);
+        vx.resizeForOverwrite(count);
+        vy.resizeForOverwrite(count);
+        radius.resizeForOverwrite(count);
+        mass.resizeForOverwrite(count);
+        color.resizeForOverwrite(count);
+        slot.resizeForOverwrite(count);
+        ++layoutVersion;
+        ++reorderVersion;
+    }
+
+    ParticleHandle handle(size_t i) const {
+        return { slot[i], slotGeneration[slot[i]] };
+    }
+
+    // Index of the particle the handle refers to, or size() if it was removed.
+    size_t indexOf(ParticleHandle particle) const {
+        if (particle.slot >= slotIndex.size() || slotGeneration[particle.slot] != particle.generation) {
+            return size();
+        }
+        return slotIndex[particle.slot];
+    }
+
+    bool isRemoved(size_t i) const {
+        return slot[i] == noSlot;
+    }
+
+    // Marks particle i as removed and frees its handle slot. It keeps moving until compactParticles drops it.
+    void remove(size_t i) {
+        uint32_t freed = slot[i];
+        if (freed == noSlot) {
+            return;
+        }
+        slotIndex[freed] = noSlot;
+        ++slotGeneration[freed];
+        freeSlots.push_back(freed);
+        slot[i] = noSlot;
+        ++removedCount;
+    }
+
+    // Removes the particle the handle refers to. Returns false if it was removed already.
+    bool remove(ParticleHandle particle) {
+        size_t i = indexOf(particle);
+        if (i == size()) {
+            return false;
+        }
+        remove(i);
+        return true;
+    }
+
+private:
+    uint32_t allocateSlot(uint32_t index) {
+        if (freeSlots.empty()) {
+            slotIndex.push_back(index);
+            slotGeneration.push_back(0);
+            return static_cast<uint32_t>(slotIndex.size() - 1);
+        }
+        uint32_t reused = freeSlots.back();
+        freeSlots.pop_back();
+        slotIndex[reused] = index;
+        return reused;
+    }
+};
+
+// Wall Table Class
+// The walls packed for the wall kernels (sweepWallBlock, sweepBallBlock): one array per value, so a block of walls loads straight into vector registers. What the swept-circle test needs per wall (edge vector, squared length and its reciprocal, unit normal) is computed once when the walls change, so the kernels multiply where sweptCircleWallHit divides.
+// A zero-length wall gets a zero normal and a zero reciprocal, which leaves only its rounded ends to be hit, as in sweptCircleWallHit.
+class WallTable {
+public:
+    std::vector<float> startX;
+    std::vector<float> startY;
+    std::vector<float> endX;
+    std::vector<float> endY;
+    std::vector<float> edgeX;
+    std::vector<float> edgeY;
+    std::vector<float> lengthSquared;
+    std::vector<float> inverseLengthSquared;
+    std::vector<float> normalX;
+    std::vector<float> normalY;
+
+    void build(const std::vector<Wall>& walls) {
+        size_t count = walls.size();
+        for (std::vector<float>* values : { &startX, &startY, &endX, &endY, &edgeX, &edgeY, &lengthSquared, &inverseLengthSquared, &normalX, &normalY }) {
+            values->resize(count);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            sf::Vector2f edge = walls[i].end - walls[i].start;
+            float squared = edge.x * edge.x + edge.y * edge.y;
+            float inverseLength = squared > 0 ? 1.0f / std::sqrt(squared) : 0.0f;
+            startX[i] = walls[i].start.x;
+            startY[i] = walls[i].start.y;
+            endX[i] = walls[i].end.x;
+            endY[i] = walls[i].end.y;
+            edgeX[i] = edge.x;
+            edgeY[i] = edge.y;
+            lengthSquared[i] = squared;
+            inverseLengthSquared[i] = squared > 0 ? 1.0f / squared : 0.0f;
+            normalX[i] = -edge.y * inverseLength;
+            normalY[i] = edge.x * inverseLength;
+        }
+    }
+
+    size_t size() const {
+        return startX.size();
+    }
+};
+
+// Swept Ball Struct
+// A ball moving in a straight line, as the wall kernels test it: its center and velocity, and what the test needs per ball (how far from a wall's center line it touches, its squared speed and the reciprocal of that) worked out once per wall search instead of once per wall.
+struct SweptBall {
+    sf::Vector2f center;
+    sf::Vector2f velocity;
+    float reach;
+    float reachSquared;
+    float speedSquared;
+    float inverseSpeedSquared; // 0 for a ball at rest
+
+    SweptBall(sf::Vector2f center, sf::Vector2f velocity, float radius) : center(center), velocity(velocity), reach(radius + Wall::thickness / 2), reachSquared(reach * reach),
+        speedSquared(velocity.x * velocity.x + velocity.y * velocity.y), inverseSpeedSquared(speedSquared != 0 ? 1.0f / speedSquared : 0.0f) {}
+};
+
+// Wall Grid Class
+// Uniform grid over the walls used as a broadphase for wall collision. Each cell lists the walls whose segment touches it, stored as one flat index array with per-cell offsets, so a ball only tests the walls in the cells its trajectory for the frame passes through.
+// The grid keeps indices into the walls vector and has to be rebuilt whenever walls are added.
+class WallGrid {
+public:
+    explicit WallGrid(float cellSize) : cellSize(cellSize), inverseCellSize(1.0f / cellSize) {}
+
+    float getCellSize() const {
+        return cellSize;
+    }
+
+    // Rebuilds the grid so that it covers the given area and every wall.
+    void build(const std::vector<Wall>& walls, const sf::FloatRect& area) {
+        float minX = area.left;
+        float minY = area.top;
+        float maxX = area.left + area.width;
+        float maxY = area.top + area.height;
+        for (const auto& wall : walls) {
+            minX = std::min({ minX, wall.start.x, wall.end.x });
+            minY = std::min({ minY, wall.start.y, wall.end.y });
+            maxX = std::max({ maxX, wall.start.x, wall.end.x });
+            maxY = std::max({ maxY, wall.start.y, wall.end.y });
+        }
+
+        originX = minX;
+        originY = minY;
+        columns = std::max(1, static_cast<int>(std::ceil((maxX - minX) * inverseCellSize)));
+        rows = std::max(1, static_cast<int>(std::ceil((maxY - minY) * inverseCellSize)));
+
+        // First pass counts the walls per cell, second pass fills the flat index array
+        cellStart.assign(static_cast<size_t>(columns) * rows + 1, 0);
+        for (const auto& wall : walls) {
+            forEachCell(wall.start, wall.end, 0.0f, [this](size_t cell) { cellStart[cell + 1]++; });
+        }
+        for (size_t cell = 1; cell < cellStart.size(); ++cell) {
+            cellStart[cell] += cellStart[cell - 1];
+        }
+
+        cellWalls.resize(cellStart.back());
+        std::vector<uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+        for (uint32_t wallIndex = 0; wallIndex < walls.size(); ++wallIndex) {
+            forEachCell(walls[wallIndex].start, walls[wallIndex].end, 0.0f, [this, &fill, wallIndex](size_t cell) {
+                cellWalls[fill[cell]++] = wallIndex;
+                });
+        }
+    }
+
+    // Calls visit(wallIndex) for every wall in the cells touched by the segment p1-p2 widened by radius. A wall spanning several of those cells is visited once per cell.
+    template <typename Visitor>
+    void forEachCandidate(sf::Vector2f p1, sf::Vector2f p2, float radius, Visitor&& visit) const {
+        if (cellWalls.empty()) {
+            return;
+        }
+        forEachCell(p1, p2, radius, [this, &visit](size_t cell) {
+            for (uint32_t i = cellStart[cell]; i < cellStart[cell + 1]; ++i) {
+                visit(cellWalls[i]);
+            }
+            });
+    }
+
+private:
+    float cellSize;
+    float inverseCellSize;
+    float originX = 0;
+    float originY = 0;
+    int columns = 0;
+    int rows = 0;
+    std::vector<uint32_t> cellStart;
+    std::vector<uint32_t> cellWalls;
+
+    int toColumn(float x) const {
+        return std::clamp(static_cast<int>(std::floor((x - originX) * inverseCellSize)), 0, columns - 1);
+    }
+
+    int toRow(float y) const {
+        return std::clamp(static_cast<int>(std::floor((y - originY) * inverseCellSize)), 0, rows - 1);
+    }
+
+    // Calls visit(cellIndex) for every cell in the segment's bounding box that the segment, widened by radius, touches. Cells are also slightly padded so segments running along a cell edge are kept in both neighbours.
+    template <typename Visitor>
+    void forEachCell(sf::Vector2f p1, sf::Vector2f p2, float radius, Visitor&& visit) const {
+        const float padding = 1e-3f * cellSize + radius;
+        int firstColumn = toColumn(std::min(p1.x, p2.x) - padding);
+        int lastColumn = toColumn(std::max(p1.x, p2.x) + padding);
+        int firstRow = toRow(std::min(p1.y, p2.y) - padding);
+        int lastRow = toRow(std::max(p1.y, p2.y) + padding);
+
+        // A single cell needs no further test, which is the common case for one frame of motion
+        if (firstColumn == lastColumn && firstRow == lastRow) {
+            visit(static_cast<size_t>(firstRow) * columns + firstColumn);
+            return;
+        }
+
+        sf::Vector2f direction = p2 - p1;
+        for (int row = firstRow; row <= lastRow; ++row) {
+            float top = originY + row * cellSize - padding;
+            float bottom = top + cellSize + 2 * padding;
+            for (int column = firstColumn; column <= lastColumn; ++column) {
+                float left = originX + column * cellSize - padding;
+                float right = left + cellSize + 2 * padding;
+
+                // The segment's line separates the cell if all four corners are on the same side of it
+                float c1 = direction.x * (top - p1.y) - direction.y * (left - p1.x);
+                float c2 = direction.x * (top - p1.y) - direction.y * (right - p1.x);
+                float c3 = direction.x * (bottom - p1.y) - direction.y * (left - p1.x);
+                float c4 = direction.x * (bottom - p1.y) - direction.y * (right - p1.x);
+                bool allAbove = c1 > 0 && c2 > 0 && c3 > 0 && c4 > 0;
+                bool allBelow = c1 < 0 && c2 < 0 && c3 < 0 && c4 < 0;
+                if (!allAbove && !allBelow) {
+                    visit(static_cast<size_t>(row) * columns + column);
+                }
+            }
+        }
+    }
+};
+
+// Wall BVH Class
+// Bounding-volume hierarchy over the walls for large or unevenly distributed wall sets where a uniform grid wastes memory or piles many walls into a few cells. It is built top-down with the binned surface area heuristic (perimeter in 2D) and flattened into one node array where both children of a node are stored next to each other.
+class WallBvh {
+public:
+    void build(const std::vector<Wall>& walls) {
+        nodes.clear();
+        wallOrder.resize(walls.size());
+        boxes.resize(walls.size());
+        centroids.resize(walls.size());
+        for (uint32_t i = 0; i < walls.size(); ++i) {
+            wallOrder[i] = i;
+            boxes[i] = Box::around(walls[i].start, walls[i].end);
+            centroids[i] = (walls[i].start + walls[i].end) * 0.5f;
+        }
+        if (walls.empty()) {
+            return;
+        }
+
+        // A binary tree with at most one wall per leaf has fewer than 2n nodes
+        nodes.reserve(walls.size() * 2);
+        nodes.push_back(Node());
+        subdivide(0, 0, static_cast<uint32_t>(walls.size()), 0);
+
+        boxes.clear();
+        boxes.shrink_to_fit();
+        centroids.clear();
+        centroids.shrink_to_fit();
+    }
+
+    // Calls visit(wallIndex) for every wall whose bounding box, grown by radius, the segment p1-p2 crosses.
+    template <typename Visitor>
+    void forEachCandidate(sf::Vector2f p1, sf::Vector2f p2, float radius, Visitor&& visit) const {
+        if (nodes.empty()) {
+            return;
+        }
+
+        sf::Vector2f direction = p2 - p1;
+        uint32_t stack[maxDepth * 2];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            const Node& node = nodes[stack[--stackSize]];
+            if (!node.bounds.crossedBy(p1, direction, radius)) {
+                continue;
+            }
+            if (node.count > 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                    visit(wallOrder[i]);
+                }
+            }
+            else {
+                stack[stackSize++] = node.first;
+                stack[stackSize++] = node.first + 1;
+            }
+        }
+    }
+
+private:
+    struct Box {
+        float minX = INFINITY;
+        float minY = INFINITY;
+        float maxX = -INFINITY;
+        float maxY = -INFINITY;
+
+        static Box around(sf::Vector2f a, sf::Vector2f b) {
+            return Box{ std::min(a.x, b.x), std::min(a.y, b.y), std::max(a.x, b.x), std::max(a.y, b.y) };
+        }
+
+        void grow(const Box& other) {
+            minX = std::min(minX, other.minX);
+            minY = std::min(minY, other.minY);
+            maxX = std::max(maxX, other.maxX);
+            maxY = std::max(maxY, other.maxY);
+        }
+
+        void grow(sf::Vector2f point) {
+            minX = std::min(minX, point.x);
+            minY = std::min(minY, point.y);
+            maxX = std::max(maxX, point.x);
+            maxY = std::max(maxY, point.y);
+        }
+
+        // Half the perimeter, the 2D stand-in for surface area in the SAH cost
+        float halfPerimeter() const {
+            return (maxX - minX) + (maxY - minY);
+        }
+
+        // Slab test of the segment p1 + t * direction, t in [0, 1], against the box grown by radius
+        bool crossedBy(sf::Vector2f p1, sf::Vector2f direction, float radius) const {
+            float tMin = 0.0f;
+            float tMax = 1.0f;
+            if (!clipAxis(p1.x, direction.x, minX - radius, maxX + radius, tMin, tMax)) {
+                return false;
+            }
+            return clipAxis(p1.y, direction.y, minY - radius, maxY + radius, tMin, tMax);
+        }
+
+        static bool clipAxis(float origin, float direction, float low, float high, float& tMin, float& tMax) {
+            if (direction == 0.0f) {
+                return origin >= low && origin <= high;
+            }
+            float inverse = 1.0f / direction;
+            float t1 = (low - origin) * inverse;
+            float t2 = (high - origin) * inverse;
+            tMin = std::max(tMin, std::min(t1, t2));
+            tMax = std::min(tMax, std::max(t1, t2));
+            return tMin <= tMax;
+        }
+    };
+
+    // Leaves have count > 0 and own wallOrder[first, first + count); inner nodes have their children at first and first + 1
+    struct Node {
+        Box bounds;
+        uint32_t first = 0;
+        uint32_t count = 0;
+    };
+
+    static const int binCount = 16;
+    static const uint32_t maxLeafSize = 4;
+    static const int sahDepthLimit = 64; // Below this depth splits fall back to the median so the tree depth stays bounded
+    static const int maxDepth = sahDepthLimit + 32;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> wallOrder;
+
+    // Only needed while building
+    std::vector<Box> boxes;
+    std::vector<sf::Vector2f> centroids;
+
+    void subdivide(uint32_t nodeIndex, uint32_t first, uint32_t count, int depth) {
+        Box bounds;
+        Box centroidBounds;
+        for (uint32_t i = first; i < first + count; ++i) {
+            bounds.grow(boxes[wallOrder[i]]);
+            centroidBounds.grow(centroids[wallOrder[i]]);
+        }
+        nodes[nodeIndex].bounds = bounds;
+
+        uint32_t leftCount = 0;
+        if (count > maxLeafSize && depth >= sahDepthLimit) {
+            leftCount = partitionByMedian(first, count, centroidBounds);
+        }
+        else if (count > 1) {
+            leftCount = partitionBySah(first, count, bounds, centroidBounds);
+        }
+
+        if (leftCount == 0 || leftCount == count) {
+            nodes[nodeIndex].first = first;
+            nodes[nodeIndex].count = count;
+            return;
+        }
+
+        uint32_t leftChild = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        nodes[nodeIndex].first = leftChild;
+        nodes[nodeIndex].count = 0;
+        subdivide(leftChild, first, leftCount, depth + 1);
+        subdivide(leftChild + 1, first + leftCount, count - leftCount, depth + 1);
+    }
+
+    // Splits wallOrder[first, first + count) in half along the longer axis of the centroids.
+    uint32_t partitionByMedian(uint32_t first, uint32_t count, const Box& centroidBounds) {
+        bool alongX = centroidBounds.maxX - centroidBounds.minX >= centroidBounds.maxY - centroidBounds.minY;
+        std::nth_element(wallOrder.begin() + first, wallOrder.begin() + first + count / 2, wallOrder.begin() + first + count, [this, alongX](uint32_t a, uint32_t b) {
+            return alongX ? centroids[a].x < centroids[b].x : centroids[a].y < centroids[b].y;
+            });
+        return count / 2;
+    }
+
+    // Picks the cheapest binned split and partitions wallOrder[first, first + count) around it. Returns the size of the left part, or 0 to make a leaf.
+    uint32_t partitionBySah(uint32_t first, uint32_t count, const Box& bounds, const Box& centroidBounds) {
+        float bestCost = INFINITY;
+        int bestAxis = -1;
+        float bestSplit = 0;
+
+        for (int axis = 0; axis < 2; ++axis) {
+            float low = axis == 0 ? centroidBounds.minX : centroidBounds.minY;
+            float high = axis == 0 ? centroidBounds.maxX : centroidBounds.maxY;
+            if (high <= low) {
+                continue;
+            }
+
+            Box binBoxes[binCount];
+            uint32_t binCounts[binCount] = {};
+            float scale = binCount / (high - low);
+            for (uint32_t i = first; i < first + count; ++i) {
+                float centroid = axis == 0 ? centroids[wallOrder[i]].x : centroids[wallOrder[i]].y;
+                int bin = std::min(binCount - 1, static_cast<int>((centroid - low) * scale));
+                binBoxes[bin].grow(boxes[wallOrder[i]]);
+                binCounts[bin]++;
+            }
+
+            // Sweep from the right to get the cost of everything right of each split, then from the left
+            float rightCosts[binCount];
+            Box rightBox;
+            uint32_t rightCount = 0;
+            for (int bin = binCount - 1; bin > 0; --bin) {
+                rightBox.grow(binBoxes[bin]);
+                rightCount += binCounts[bin];
+                rightCosts[bin] = rightCount > 0 ? rightCount * rightBox.halfPerimeter() : 0.0f;
+            }
+
+            Box leftBox;
+            uint32_t leftCount = 0;
+            for (int bin = 0; bin < binCount - 1; ++bin) {
+                leftBox.grow(binBoxes[bin]);
+                leftCount += binCounts[bin];
+                if (leftCount == 0 || leftCount == count) {
+                    continue;
+                }
+                float cost = leftCount * leftBox.halfPerimeter() + rightCosts[bin + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = low + (bin + 1) / scale;
+                }
+            }
+        }
+
+        float leafCost = count * bounds.halfPerimeter();
+        if (bestAxis < 0 || (bestCost >= leafCost && count <= maxLeafSize)) {
+            if (count <= maxLeafSize) {
+                return 0;
+            }
+            // Every centroid is in the same spot; split the list in half so leaves stay small
+            return partitionByMedian(first, count, centroidBounds);
+        }
+
+        auto middle = std::partition(wallOrder.begin() + first, wallOrder.begin() + first + count, [this, bestAxis, bestSplit](uint32_t wall) {
+            return (bestAxis == 0 ? centroids[wall].x : centroids[wall].y) < bestSplit;
+            });
+        return static_cast<uint32_t>(middle - (wallOrder.begin() + first));
+    }
+};
+
+// Broadphase Modes
+// Ways of finding the walls a ball may hit: test every wall, or query the uniform grid or the BVH.
+enum class BroadphaseMode {
+    Linear,
+    Grid,
+    Bvh
+};
+
+// Wall Broadphase Class
+// Owns the acceleration structures over the walls and answers candidate queries with whichever one is selected, so the modes can be switched at runtime and compared on the same scene. Only the selected structure is kept built.
+class WallBroadphase {
+public:
+    BroadphaseMode mode;
+    WallGrid grid;
+    WallBvh bvh;
+    WallTable table; // Kept in every mode, for the vectorized narrow phase
+
+    WallBroadphase(BroadphaseMode mode, float gridCellSize) : mode(mode), grid(gridCellSize) {}
+
+    // Rebuilds the selected structure after the walls changed.
+    void build(const std::vector<Wall>& walls, const sf::FloatRect& area) {
+        wallCount = walls.size();
+        table.build(walls);
+        if (mode == BroadphaseMode::Grid) {
+            grid.build(walls, area);
+        }
+        else if (mode == BroadphaseMode::Bvh) {
+            bvh.build(walls);
+        }
+    }
+
+    void setMode(BroadphaseMode newMode, const std::vector<Wall>& walls, const sf::FloatRect& area) {
+        mode = newMode;
+        grid = WallGrid(grid.getCellSize());
+        bvh = WallBvh();
+        build(walls, area);
+    }
+
+    const char* getModeName() const {
+        switch (mode) {
+        case BroadphaseMode::Grid:
+            return "Grid";
+        case BroadphaseMode::Bvh:
+            return "BVH";
+        default:
+            return "Linear";
+        }
+    }
+
+    // Calls visit(wallIndex) for every wall within radius of the segment p1-p2, and possibly some further away.
+    template <typename Visitor>
+    void forEachCandidate(sf::Vector2f p1, sf::Vector2f p2, float radius, Visitor&& visit) const {
+        switch (mode) {
+        case BroadphaseMode::Grid:
+            grid.forEachCandidate(p1, p2, radius, visit);
+            break;
+        case BroadphaseMode::Bvh:
+            bvh.forEachCandidate(p1, p2, radius, visit);
+            break;
+        default:
+            for (uint32_t i = 0; i < wallCount; ++i) {
+                visit(i);
+            }
+            break;
+        }
+    }
+
+private:
+    size_t wallCount = 0;
+};
+
+// Thread Load Struct
+// How one thread of the pool spent the time of the parallel jobs since the last resetLoad: running chunks, or waiting for the slowest thread to finish. Even busy times across the threads mean the work was balanced.
+struct ThreadLoad {
+    double busySeconds = 0;
+    double idleSeconds = 0;
+    uint64_t chunks = 0; // Chunks run, including stolen ones
+    uint64_t steals = 0; // Chunks taken from another thread's range
+};
+
+// Thread Pool Class
+// Keeps a fixed set of worker threads alive for the whole run so parallel work does not pay for thread creation every frame. parallelFor splits an index range into grain-sized chunks and returns once the whole range is done (fork-join).
+// Chunks are scheduled by work stealing: every thread starts with an equal contiguous run of chunks and takes them from the front, and a thread that runs out takes single chunks from the back of another thread's run. Threads stay on neighbouring balls while the load is even, and balls that cost more (near dense walls, in crowded cells) no longer leave one thread finishing alone.
+// Idle workers spin for spinCount iterations before sleeping on a condition variable, so back-to-back jobs are picked up without a wake-up while a paused simulation costs no CPU.
+// parallelFor must only be called from one thread at a time and not from inside another parallelFor.
+class ThreadPool {
+public:
+    ThreadPool(size_t workerCount, unsigned int spinCount) : spinCount(spinCount), slots(workerCount + 1) {
+        workers.reserve(workerCount);
+        for (size_t i = 0; i < workerCount; ++i) {
+            workers.emplace_back([this, i]() { workerLoop(i + 1); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeCondition.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads that take part in a parallelFor, including the caller.
+    size_t threadCount() const {
+        return workers.size() + 1;
+    }
+
+    void setSpinCount(unsigned int count) {
+        spinCount.store(count, std::memory_order_relaxed);
+    }
+
+    // Load of every thread since the last resetLoad, the calling thread first. Only valid between parallelFor calls.
+    std::vector<ThreadLoad> getLoad() const {
+        std::vector<ThreadLoad> load;
+        load.reserve(slots.size());
+        for (const auto& slot : slots) {
+            load.push_back(slot.load);
+        }
+        return load;
+    }
+
+    void resetLoad() {
+        for (auto& slot : slots) {
+            slot.load = ThreadLoad();
+        }
+    }
+
+    // Calls function(first, last) for consecutive sub-ranges of [begin, end) no larger than grainSize.
+    template <typename Function>
+    void parallelFor(size_t begin, size_t end, size_t grainSize, Function&& function) {
+        if (begin >= end) {
+            return;
+        }
+        grainSize = std::max<size_t>(grainSize, 1);
+
+        // Small ranges are not worth waking the workers for
+        if (workers.empty() || end - begin <= grainSize) {
+            auto start = std::chrono::steady_clock::now();
+            function(begin, end);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            slots[0].load.busySeconds += seconds;
+            slots[0].load.chunks += 1;
+            for (size_t i = 1; i < slots.size(); ++i) {
+                slots[i].load.idleSeconds += seconds;
+            }
+            return;
+        }
+
+        using FunctionType = std::remove_reference_t<Function>;
+        void* context = const_cast<void*>(static_cast<const void*>(std::addressof(function)));
+        run(begin, end, grainSize, [](void* context, size_t first, size_t last) {
+            (*static_cast<FunctionType*>(context))(first, last);
+            }, context);
+    }
+
+private:
+    using JobFunction = void (*)(void*, size_t, size_t);
+
+    // The chunks a thread still owns in the current job, [front, back) packed into one word so the owner and thieves can both shrink it with a compare-and-swap. Runs only shrink during a job, so a stale value can never match again.
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> chunks{ 0 };
+        double busySeconds = 0; // Time the thread spent on the current job
+        ThreadLoad load;
+    };
+
+    std::vector<std::thread> workers;
+    std::atomic<unsigned int> spinCount;
+    std::vector<Slot> slots; // One per thread, the calling thread at index 0
+
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    bool stopping = false;
+    std::atomic<unsigned int> generation{ 0 };
+    std::atomic<size_t> activeWorkers{ 0 };
+
+    // Current job, published to the workers by bumping generation
+    JobFunction jobFunction = nullptr;
+    void* jobContext = nullptr;
+    size_t jobBegin = 0;
+    size_t jobEnd = 0;
+    size_t jobGrain = 1;
+
+    static uint64_t packChunks(uint64_t front, uint64_t back) {
+        return front | (back << 32);
+    }
+
+    void run(size_t begin, size_t end, size_t grainSize, JobFunction function, void* context) {
+        // Chunk numbers have to fit in 32 bits
+        grainSize = std::max<size_t>(grainSize, (end - begin) / 0x7FFFFFFF + 1);
+        size_t chunkCount = (end - begin + grainSize - 1) / grainSize;
+        for (size_t i = 0; i < slots.size(); ++i) {
+            slots[i].chunks.store(packChunks(chunkCount * i / slots.size(), chunkCount * (i + 1) / slots.size()), std::memory_order_relaxed);
+        }
+        jobFunction = function;
+        jobContext = context;
+        jobBegin = begin;
+        jobEnd = end;
+        jobGrain = grainSize;
+        activeWorkers.store(workers.size(), std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            generation.fetch_add(1, std::memory_order_release);
+        }
+        wakeCondition.notify_all();
+
+        // The calling thread works on the job as well
+        runChunks(0);
+
+        // Wait for the workers to finish their last chunks
+        if (!spinUntil([this]() { return activeWorkers.load(std::memory_order_acquire) == 0; })) {
+            std::unique_lock<std::mutex> lock(mutex);
+            doneCondition.wait(lock, [this]() { return activeWorkers.load(std::memory_order_acquire) == 0; });
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (auto& slot : slots) {
+            slot.load.busySeconds += slot.busySeconds;
+            slot.load.idleSeconds += std::max(seconds - slot.busySeconds, 0.0);
+        }
+    }
+
+    // Takes the chunk at the front of the slot's run (own is true) or at the back (stealing). Returns false once the run is empty.
+    static bool takeChunk(Slot& slot, bool own, size_t& chunk) {
+        uint64_t chunks = slot.chunks.load(std::memory_order_relaxed);
+        while (true) {
+            uint64_t front = chunks & 0xFFFFFFFF;
+            uint64_t back = chunks >> 32;
+            if (front >= back) {
+                return false;
+            }
+            uint64_t remaining = own ? packChunks(front + 1, back) : packChunks(front, back - 1);
+            if (slot.chunks.compare_exchange_weak(chunks, remaining, std::memory_order_relaxed)) {
+                chunk = static_cast<size_t>(own ? front : back - 1);
+                return true;
+            }
+        }
+    }
+
+    // Runs the thread's own chunks, then steals from the other threads in turn until no chunk is left anywhere.
+    void runChunks(size_t thread) {
+        auto start = std::chrono::steady_clock::now();
+        Slot& own = slots[thread];
+        size_t chunk;
+        while (takeChunk(own, true, chunk)) {
+            runChunk(chunk);
+            ++own.load.chunks;
+        }
+        for (size_t offset = 1; offset < slots.size(); ++offset) {
+            Slot& victim = slots[(thread + offset) % slots.size()];
+            while (takeChunk(victim, false, chunk)) {
+                runChunk(chunk);
+                ++own.load.chunks;
+                ++own.load.steals;
+            }
+        }
+        own.busySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void runChunk(size_t chunk) {
+        size_t first = jobBegin + chunk * jobGrain;
+        jobFunction(jobContext, first, std::min(first + jobGrain, jobEnd));
+    }
+
+    template <typename Predicate>
+    bool spinUntil(Predicate predicate) {
+        unsigned int spins = spinCount.load(std::memory_order_relaxed);
+        for (unsigned int i = 0; i < spins; ++i) {
+            if (predicate()) {
+                return true;
+            }
+            CPU_RELAX();
+        }
+        return predicate();
+    }
+
+    void workerLoop(size_t thread) {
+        unsigned int seenGeneration = 0;
+        while (true) {
+            auto hasWork = [this, &seenGeneration]() { return generation.load(std::memory_order_acquire) != seenGeneration; };
+            if (!spinUntil(hasWork)) {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeCondition.wait(lock, [this, &hasWork]() { return stopping || hasWork(); });
+                if (stopping) {
+                    return;
+                }
+            }
+            seenGeneration = generation.load(std::memory_order_acquire);
+
+            runChunks(thread);
+
+            if (activeWorkers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(mutex);
+                doneCondition.notify_one();
+            }
+        }
+    }
+};
+
+// Ball Grid Class
+// Cell list over the balls used to find touching pairs without testing every pair. Cells are as wide as the largest ball, so every ball a ball can touch is in its own cell or one of the eight around it. The list is rebuilt every step in parallel: balls are counted per cell, the counts are turned into offsets, and the ball indices are scattered into one flat array sorted within each cell so the result does not depend on thread timing.
+class BallGrid {
+public:
+    void build(const ParticleStore& particles, const sf::FloatRect& area, ThreadPool& pool) {
+        size_t count = particles.size();
+        cellSize = std::max(2.0f * particles.maxRadius, minimumCellSize);
+        originX = area.left;
+        originY = area.top;
+        columns = std::max(1, static_cast<int>(std::ceil(area.width / cellSize)));
+        rows = std::max(1, static_cast<int>(std::ceil(area.height / cellSize)));
+        inverseCellSize = 1.0f / cellSize;
+
+        size_t cellCount = static_cast<size_t>(columns) * rows;
+        cellStart.assign(cellCount + 1, 0);
+        ballCell.resize(count);
+        cellBalls.resize(count);
+        collided.resize(count, 0);
+
+        pool.parallelFor(0, count, grainSize, [this, &particles](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                uint32_t cell = cellAt(particles.x[i] + particles.radius[i], particles.y[i] + particles.radius[i]);
+                ballCell[i] = cell;
+                std::atomic_ref<uint32_t>(cellStart[cell + 1]).fetch_add(1, std::memory_order_relaxed);
+            }
+            });
+
+        for (size_t cell = 1; cell <= cellCount; ++cell) {
+            cellStart[cell] += cellStart[cell - 1];
+        }
+
+        cursor.assign(cellStart.begin(), cellStart.end() - 1);
+        pool.parallelFor(0, count, grainSize, [this](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                uint32_t slot = std::atomic_ref<uint32_t>(cursor[ballCell[i]]).fetch_add(1, std::memory_order_relaxed);
+                cellBalls[slot] = static_cast<uint32_t>(i);
+            }
+            });
+
+        pool.parallelFor(0, cellCount, grainSize, [this](size_t first, size_t last) {
+            for (size_t cell = first; cell < last; ++cell) {
+                std::sort(cellBalls.begin() + cellStart[cell], cellBalls.begin() + cellStart[cell + 1]);
+            }
+            });
+    }
+
+    int getColumns() const {
+        return columns;
+    }
+
+    int getRows() const {
+        return rows;
+    }
+
+    // Indices of the balls in the given cell, in ascending order.
+    const uint32_t* cellBegin(int column, int row) const {
+        return cellBalls.data() + cellStart[static_cast<size_t>(row) * columns + column];
+    }
+
+    const uint32_t* cellEnd(int column, int row) const {
+        return cellBalls.data() + cellStart[static_cast<size_t>(row) * columns + column + 1];
+    }
+
+    // One flag per ball for resolveBallCollisions to mark the balls that collided while recording. It clears the ones it set, so they are all clear between steps.
+    uint8_t* collidedFlags() {
+        return collided.data();
+    }
+
+private:
+    static constexpr float minimumCellSize = 1.0f;
+    static const size_t grainSize = 4096;
+
+    float cellSize = minimumCellSize;
+    float inverseCellSize = 1.0f / minimumCellSize;
+    float originX = 0;
+    float originY = 0;
+    int columns = 0;
+    int rows = 0;
+    std::vector<uint32_t> cellStart;
+    std::vector<uint32_t> cursor;
+    std::vector<uint32_t> ballCell;
+    std::vector<uint32_t> cellBalls;
+    std::vector<uint8_t> collided;
+
+    int toColumn(float x) const {
+        return std::clamp(static_cast<int>(std::floor((x - originX) * inverseCellSize)), 0, columns - 1);
+    }
+
+    int toRow(float y) const {
+        return std::clamp(static_cast<int>(std::floor((y - originY) * inverseCellSize)), 0, rows - 1);
+    }
+
+    uint32_t cellAt(float x, float y) const {
+        return static_cast<uint32_t>(toRow(y) * columns + toColumn(x));
+    }
+};
+
+// Particle Event Struct
+// A particle changed course: from time on it moves from (x, y) with velocity (vx, vy). time counts in seconds from the end of the step (or flush) that produced the event, which is the time of the batch it is recorded in, so it is 0 or negative. Event files store it in this layout.
+struct ParticleEvent {
+    uint32_t particle;
+    float time;
+    float x;
+    float y;
+    float vx;
+    float vy;
+};
+static_assert(sizeof(ParticleEvent) == 24, "particle events are stored as they are");
+
+// Event Log Class
+// Collects the ParticleEvents the engines report where balls bounce, while the event recorder runs. A parallel work item gathers its events in a local vector and adds them in one go, so the log is locked once per work item that saw a bounce rather than once per bounce. Every pass over the balls gives each ball to one work item and the passes of a step run one after another, so the events of a ball arrive in the order they happened.
+class EventLog {
+public:
+    // Moves the events in found to the log, leaving found empty.
+    void add(std::vector<ParticleEvent>& found) {
+        if (found.empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        events.insert(events.end(), found.begin(), found.end());
+        found.clear();
+    }
+
+    // Hands over the events collected so far and empties the log.
+    std::vector<ParticleEvent> take() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<ParticleEvent> taken;
+        taken.swap(events);
+        return taken;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<ParticleEvent> events;
+};
+
+// Event Engine Class
+// Alternative to moving every ball every step. Between collisions a ball moves in a straight line, so the engine predicts when each ball next hits the boundary or a wall and keeps those events in a priority queue. Advancing time only pops the events that are due, bounces those balls at the exact point of impact and predicts their next event; everything else is moved analytically from the position and time of its last bounce. Wall hits use the same swept-circle test as the frame-step engine.
+// Ball-ball collisions are not predicted, and predictions go stale when walls change, so reset() must be called after walls are added.
+// With an event log, every bounce is reported at the time it happens, and every ball that ends an advance wedged at where it stopped.
+class EventEngine {
+public:
+    // Forgets every prediction; all balls are rescheduled from their current state on the next advance.
+    void reset() {
+        scheduled = 0;
+        events.clear();
+        waitingBalls.clear();
+    }
+
+    size_t getLastEventCount() const {
+        return lastEventCount;
+    }
+
+    void advance(ParticleStore& particles, const sf::FloatRect& boundary, const std::vector<Wall>& walls, const WallBroadphase& broadphase, float deltaTime, ThreadPool& pool, EventLog* log = nullptr) {
+        Bounds bounds{ boundary.left, boundary.left + boundary.width, boundary.top, boundary.top + boundary.height };
+        schedule(particles, bounds, walls, broadphase, pool);
+
+        // Balls that waited out the last advance start moving again from where they stopped
+        for (uint32_t i : waitingBalls) {
+            startTime[i] = now;
+            waiting[i] = 0;
+            events.push_back(predict(particles, i, bounds, walls, broadphase));
+            std::push_heap(events.begin(), events.end(), std::greater<Event>());
+        }
+        waitingBalls.clear();
+
+        double targetTime = now + deltaTime;
+        lastEventCount = 0;
+        std::vector<ParticleEvent> found;
+        while (!events.empty() && events.front().time <= targetTime) {
+            std::pop_heap(events.begin(), events.end(), std::greater<Event>());
+            Event event = events.back();
+            events.pop_back();
+            uint32_t i = event.particle;
+            if (event.version != version[i]) {
+                continue; // The ball bounced since this was predicted
+            }
+
+            if (++eventCount[i] > maxEventsPerBall) {
+                // Wedged ball: it stops where it is until the next advance, like the frame-step engine drops the rest of the step
+                wait(particles, event);
+                waitingBalls.push_back(i);
+                continue;
+            }
+
+            bounce(particles, event, bounds, walls);
+            ++lastEventCount;
+            if (log != nullptr) {
+                found.push_back({ i, static_cast<float>(event.time - targetTime), startX[i], startY[i], particles.vx[i], particles.vy[i] });
+            }
+            events.push_back(predict(particles, i, bounds, walls, broadphase));
+            std::push_heap(events.begin(), events.end(), std::greater<Event>());
+        }
+        now = targetTime;
+        if (log != nullptr) {
+            // Wedged balls stay where they stopped instead of following their last event
+            for (uint32_t i : waitingBalls) {
+                found.push_back({ i, 0.0f, startX[i], startY[i], particles.vx[i], particles.vy[i] });
+            }
+            log->add(found);
+        }
+
+        // Bring the stored positions up to date for drawing and for the other engine
+        pool.parallelFor(0, scheduled, physicsGrainSize, [this, &particles](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                float elapsed = waiting[i] ? 0.0f : static_cast<float>(now - startTime[i]);
+                particles.x[i] = startX[i] + particles.vx[i] * elapsed;
+                particles.y[i] = startY[i] + particles.vy[i] * elapsed;
+                eventCount[i] = 0;
+            }
+            });
+    }
+
+private:
+    // What an event hits: a wall index, or one of these for the boundary
+    static const int32_t hitsSide = -1;
+    static const int32_t hitsTopOrBottom = -2;
+    static const int32_t hitsCorner = -3;
+    static const uint32_t maxEventsPerBall = 64; // Bounces one ball may make in one advance, so a ball wedged between walls cannot stall the frame
+
+    struct Event {
+        double time;
+        uint32_t particle;
+        uint32_t version;
+        int32_t target;
+
+        bool operator>(const Event& other) const {
+            return time > other.time || (time == other.time && particle > other.particle);
+        }
+    };
+
+    // Limits of the top-left corner of a ball of the given radius, matching the frame-step update
+    struct Bounds {
+        float left, right, top, bottom;
+
+        float minX(float radius) const { return left + radius; }
+        float maxX(float radius) const { return right - radius * 2; }
+        float minY(float radius) const { return top + radius; }
+        float maxY(float radius) const { return bottom - radius * 2; }
+    };
+
+    double now = 0;
+    size_t scheduled = 0;
+    size_t lastEventCount = 0;
+    std::vector<Event> events; // Min-heap on time
+
+    // State of each ball at its last bounce
+    std::vector<float> startX;
+    std::vector<float> startY;
+    std::vector<double> startTime;
+    std::vector<uint32_t> version;
+    std::vector<uint32_t> eventCount; // Bounces in the current advance
+    std::vector<uint8_t> waiting; // Set while a wedged ball sits out the rest of an advance
+    std::vector<uint32_t> waitingBalls;
+
+    // Starts tracking balls that were added (or all balls after a reset) from their current position.
+    void schedule(const ParticleStore& particles, const Bounds& bounds, const std::vector<Wall>& walls, const WallBroadphase& broadphase, ThreadPool& pool) {
+        size_t count = particles.size();
+        if (scheduled == count) {
+            return;
+        }
+
+        size_t first = scheduled;
+        startX.resize(count);
+        startY.resize(count);
+        startTime.resize(count);
+        version.resize(count);
+        eventCount.resize(count);
+        waiting.resize(count);
+        events.resize(events.size() + (count - first));
+        Event* newEvents = events.data() + events.size() - (count - first);
+
+        pool.parallelFor(first, count, physicsGrainSize, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                startX[i] = particles.x[i];
+                startY[i] = particles.y[i];
+                startTime[i] = now;
+                version[i] = 0;
+                eventCount[i] = 0;
+                waiting[i] = 0;
+                newEvents[i - first] = predict(particles, static_cast<uint32_t>(i), bounds, walls, broadphase);
+            }
+            });
+        std::make_heap(events.begin(), events.end(), std::greater<Event>());
+        scheduled = count;
+    }
+
+    // Finds the next boundary or wall hit of ball i, starting from its last bounce.
+    Event predict(const ParticleStore& particles, uint32_t i, const Bounds& bounds, const std::vector<Wall>& walls, const WallBroadphase& broadphase) const {
+        const float infinity = std::numeric_limits<float>::infinity();
+        float x = startX[i];
+        float y = startY[i];
+        float vx = particles.vx[i];
+        float vy = particles.vy[i];
+        float radius = particles.radius[i];
+
+        // Time to the side the ball is moving towards; a ball already past it bounces right away
+        float tSide = infinity;
+        if (vx < 0) {
+            tSide = std::max((bounds.minX(radius) - x) / vx, 0.0f);
+        }
+        else if (vx > 0) {
+            tSide = std::max((bounds.maxX(radius) - x) / vx, 0.0f);
+        }
+        float tTopOrBottom = infinity;
+        if (vy < 0) {
+            tTopOrBottom = std::max((bounds.minY(radius) - y) / vy, 0.0f);
+        }
+        else if (vy > 0) {
+            tTopOrBottom = std::max((bounds.maxY(radius) - y) / vy, 0.0f);
+        }
+
+        float best = std::min(tSide, tTopOrBottom);
+        int32_t target = tSide == tTopOrBottom ? hitsCorner : (tSide < tTopOrBottom ? hitsSide : hitsTopOrBottom);
+        if (best == infinity) {
+            return Event{ std::numeric_limits<double>::infinity(), i, version[i], target };
+        }
+
+        // Only walls hit before the boundary matter
+        if (!walls.empty()) {
+            sf::Vector2f center(x + radius, y + radius);
+            sf::Vector2f velocity(vx, vy);
+            float reach = radius + Wall::thickness / 2;
+            broadphase.forEachCandidate(center, center + velocity * best, reach, [&](uint32_t wallIndex) {
+                float t;
+                sf::Vector2f normal;
+                if (sweptCircleWallHit(center, velocity, radius, walls[wallIndex], best, t, normal) && t < best) {
+                    best = t;
+                    target = static_cast<int32_t>(wallIndex);
+                }
+                });
+        }
+
+        return Event{ startTime[i] + best, i, version[i], target };
+    }
+
+    // Moves the ball to the point of the event and reflects its velocity.
+    void bounce(ParticleStore& particles, const Event& event, const Bounds& bounds, const std::vector<Wall>& walls) {
+        uint32_t i = event.particle;
+        float elapsed = static_cast<float>(event.time - startTime[i]);
+        float& vx = particles.vx[i];
+        float& vy = particles.vy[i];
+        float radius = particles.radius[i];
+        float x = startX[i] + vx * elapsed;
+        float y = startY[i] + vy * elapsed;
+
+        if (event.target >= 0) {
+            sf::Vector2f center(x + radius, y + radius);
+            sf::Vector2f reflected = reflect(sf::Vector2f(vx, vy), wallContactNormal(center, walls[event.target], sf::Vector2f(vx, vy)));
+            vx = reflected.x;
+            vy = reflected.y;
+        }
+        else {
+            if (event.target == hitsSide || event.target == hitsCorner) {
+                x = vx < 0 ? bounds.minX(radius) : bounds.maxX(radius);
+                vx = -vx;
+            }
+            if (event.target == hitsTopOrBottom || event.target == hitsCorner) {
+                y = vy < 0 ? bounds.minY(radius) : bounds.maxY(radius);
+                vy = -vy;
+            }
+        }
+
+        startX[i] = x;
+        startY[i] = y;
+        startTime[i] = event.time;
+        ++version[i];
+    }
+
+    // Stops the ball at the point of the event without bouncing it.
+    void wait(const ParticleStore& particles, const Event& event) {
+        uint32_t i = event.particle;
+        float elapsed = static_cast<float>(event.time - startTime[i]);
+        startX[i] += particles.vx[i] * elapsed;
+        startY[i] += particles.vy[i] * elapsed;
+        startTime[i] = event.time;
+        waiting[i] = 1;
+        ++version[i];
+    }
+};
+
+// Update Scheduler Class
+// Level of detail for the frame-step engine: moves each ball only as often as its motion needs. After every update a ball gets a cadence of 1 to maxUpdateCadence steps and is left alone until that many steps have passed; the skipped time is kept and moved in one go by updateBall at the next update, with the same continuous wall collision.
+// The cadence is the largest number of steps that keeps the ball within maxLagDistance of where it should be, ends before it reaches the boundary and ends before it hits a wall, so slow balls and balls far from walls are updated rarely while fast balls next to walls are updated every step.
+// Only the walls and the boundary change a ball's course then, and the cadence ends before it reaches either, so a skipped ball keeps its velocity: the scheduler is only run while ball collisions are off.
+class UpdateScheduler {
+public:
+    // Moves every ball that is due by its skipped time plus deltaTime. With an event log, the bounces are reported to it.
+    void step(ParticleStore& particles, const sf::FloatRect& boundary, const std::vector<Wall>& walls, const WallBroadphase& broadphase, float deltaTime, ThreadPool& pool, SimdLevel simd, EventLog* log = nullptr) {
+        grow(particles.size());
+        std::atomic<size_t> updates{ 0 };
+        pool.parallelFor(0, particles.size(), physicsGrainSize, [&](size_t first, size_t last) {
+            std::vector<ParticleEvent> found;
+            size_t chunkUpdates = 0;
+            for (size_t i = first; i < last; ++i) {
+                float skipped = skippedTime[i];
+                if (--stepsLeft[i] > 0) {
+                    skippedTime[i] = skipped + deltaTime;
+                    continue;
+                }
+                // The wall search looks as far ahead as the ball could be skipped for, which tells how long it stays clear of walls
+                float horizon = skipHorizon(particles.vx[i], particles.vy[i], deltaTime);
+                float clearTime = updateBall(particles, i, boundary, walls, broadphase, skipped + deltaTime, simd, log != nullptr ? &found : nullptr, horizon);
+                skippedTime[i] = 0;
+                stepsLeft[i] = static_cast<uint8_t>(cadence(particles, i, boundary, clearTime, deltaTime));
+                ++chunkUpdates;
+            }
+            updates.fetch_add(chunkUpdates, std::memory_order_relaxed);
+            if (log != nullptr) {
+                log->add(found);
+            }
+            });
+        lastUpdateCount = updates.load(std::memory_order_relaxed);
+        skipping = true;
+    }
+
+    // Moves every skipped ball to where it should be now, so that all positions are current (e.g. before the engine or the walls change). With an event log, the bounces are reported to it.
+    void flush(ParticleStore& particles, const sf::FloatRect& boundary, const std::vector<Wall>& walls, const WallBroadphase& broadphase, ThreadPool& pool, SimdLevel simd, EventLog* log = nullptr) {
+        if (!skipping) {
+            return;
+        }
+        skipping = false;
+        grow(particles.size());
+        pool.parallelFor(0, particles.size(), physicsGrainSize, [&](size_t first, size_t last) {
+            std::vector<ParticleEvent> found;
+            for (size_t i = first; i < last; ++i) {
+                if (skippedTime[i] > 0) {
+                    updateBall(particles, i, boundary, walls, broadphase, skippedTime[i], simd, log != nullptr ? &found : nullptr);
+                    skippedTime[i] = 0;
+                }
+                stepsLeft[i] = 1;
+            }
+            if (log != nullptr) {
+                log->add(found);
+            }
+            });
+    }
+
+    // Forgets all cadences, e.g. after the balls were reordered; every ball is moved on the next step. Call flush first so no skipped time is lost.
+    void reset() {
+        skippedTime.clear();
+        stepsLeft.clear();
+        skipping = false;
+    }
+
+    // Number of balls moved by the last step.
+    size_t getLastUpdateCount() const {
+        return lastUpdateCount;
+    }
+
+    // Where ball i should be now: where it was last moved plus its skipped time at its velocity. The cadence ends before the ball reaches a wall or the boundary, so nothing lies on that path.
+    sf::Vector2f currentPosition(const ParticleStore& particles, size_t i) const {
+        if (!skipping || i >= skippedTime.size() || skippedTime[i] <= 0) {
+            return sf::Vector2f(particles.x[i], particles.y[i]);
+        }
+        return sf::Vector2f(particles.x[i] + particles.vx[i] * skippedTime[i], particles.y[i] + particles.vy[i] * skippedTime[i]);
+    }
+
+private:
+    std::vector<float> skippedTime; // Time since the ball was last moved
+    std::vector<uint8_t> stepsLeft; // Steps until the next update
+    size_t lastUpdateCount = 0;
+    bool skipping = false; // Whether balls may be behind since the last flush
+
+    // New balls are due on the next step.
+    void grow(size_t count) {
+        if (stepsLeft.size() >= count) {
+            return;
+        }
+        skippedTime.resize(count, 0.0f);
+        stepsLeft.resize(count, 1);
+    }
+
+    // Longest time a ball moving at this velocity may be skipped for: it must not fall more than maxLagDistance behind. 0 if it cannot be skipped at all.
+    static float skipHorizon(float vx, float vy, float deltaTime) {
+        float speed = std::sqrt(vx * vx + vy * vy);
+        if (speed * deltaTime * 2 > maxLagDistance) {
+            return 0.0f;
+        }
+        return std::min(maxUpdateCadence * deltaTime, speed > 0 ? maxLagDistance / speed : std::numeric_limits<float>::infinity());
+    }
+
+    // Steps ball i can be skipped for after its update, given how long it stays clear of walls: the skipped time must also end before it reaches the boundary.
+    static int cadence(const ParticleStore& particles, size_t i, const sf::FloatRect& boundary, float clearTime, float deltaTime) {
+        float horizon = clearTime;
+        if (horizon < 2 * deltaTime) {
+            return 1;
+        }
+        float vx = particles.vx[i];
+        float vy = particles.vy[i];
+        float radius = particles.radius[i];
+        float x = particles.x[i];
+        float y = particles.y[i];
+        if (vx < 0) {
+            horizon = std::min(horizon, (x - (boundary.left + radius)) / -vx);
+        }
+        else if (vx > 0) {
+            horizon = std::min(horizon, (boundary.left + boundary.width - radius * 2 - x) / vx);
+        }
+        if (vy < 0) {
+            horizon = std::min(horizon, (y - (boundary.top + radius)) / -vy);
+        }
+        else if (vy > 0) {
+            horizon = std::min(horizon, (boundary.top + boundary.height - radius * 2 - y) / vy);
+        }
+        return std::clamp(static_cast<int>(horizon / deltaTime), 1, maxUpdateCadence);
+    }
+};
+
+// Command Queue Class
+// Hands spawn and wall requests from any thread to the simulation without locks. Each post is one command holding a whole batch; posting pushes it onto a lock-free stack with a compare-and-swap, and the simulation takes the whole stack in one exchange and applies it oldest first. Since the consumer never pops single commands, the stack cannot suffer from ABA.
+// Any number of threads may post; only the simulation drains.
+class CommandQueue {
+public:
+    struct Command {
+        std::vector<Ball> balls;
+        std::vector<Wall> walls;
+        std::vector<SpawnBatch> batches;
+        std::vector<ParticleHandle> removals;
+        std::vector<sf::FloatRect> clearedAreas; // Every ball with its center inside is removed
+        bool cancelSpawns = false; // Drop the part of earlier spawn batches that is not alive yet
+        Command* next = nullptr;
+    };
+
+    CommandQueue() = default;
+    CommandQueue(const CommandQueue&) = delete;
+    CommandQueue& operator=(const CommandQueue&) = delete;
+
+    ~CommandQueue() {
+        Command* command = head.exchange(nullptr, std::memory_order_acquire);
+        while (command) {
+            Command* next = command->next;
+            delete command;
+            command = next;
+        }
+    }
+
+    void post(Command command) {
+        Command* node = new Command(std::move(command));
+        node->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_relaxed) == nullptr;
+    }
+
+    // Takes every posted command and calls apply(command) on each in the order they were posted.
+    template <typename Function>
+    void drain(Function&& apply) {
+        Command* command = head.exchange(nullptr, std::memory_order_acquire);
+
+        // The stack holds the newest command first
+        Command* oldest = nullptr;
+        while (command) {
+            Command* next = command->next;
+            command->next = oldest;
+            oldest = command;
+            command = next;
+        }
+        while (oldest) {
+            Command* next = oldest->next;
+            apply(*oldest);
+            delete oldest;
+            oldest = next;
+        }
+    }
+
+private:
+    std::atomic<Command*> head{ nullptr };
+};
+
+// Mapped File Class
+// Maps a whole file read-only into memory (mmap, or MapViewOfFile on Windows), so its contents can be used without reading them through a buffer first; the system pages in what is touched. data is nullptr if the file cannot be opened or is empty. The mapping is released with the object.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data = nullptr;
+    size_t size = 0;
+};
+
+// Trajectory Frame Struct
+// Positions and velocities of all particles at one step, as captured by the TrajectoryRecorder. Keyframes also carry the radius and color of every particle.
+struct TrajectoryFrame {
+    uint64_t step = 0; // Steps since the recording started
+    double time = 0; // Simulated time in seconds
+    bool keyframe = false;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> vx;
+    std::vector<float> vy;
+    std::vector<float> radius; // Keyframes only
+    std::vector<std::uint32_t> color; // Keyframes only
+};
+
+// Trajectory Index Entry Struct
+// Where a frame of a trajectory file starts and what it holds. The index at the end of the file has one per frame, in this layout.
+const uint32_t trajectoryKeyframe = 1; // Flag of a frame stored in full
+
+struct TrajectoryIndexEntry {
+    uint64_t offset; // Of the frame header, from the start of the file
+    uint64_t step;
+    double time;
+    uint64_t particleCount;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+// Trajectory Encoder Struct
+// What the trajectory writer keeps between frames: the quantized values of the last frame, which the next one is stored as changes to, and the index of the frames written so far.
+struct TrajectoryEncoder {
+    std::vector<int64_t> x;
+    std::vector<int64_t> y;
+    std::vector<int64_t> vx;
+    std::vector<int64_t> vy;
+    std::vector<uint8_t> buffer; // Encoded frame, reused
+    uint64_t offset = 0; // Where the next frame goes in the file
+    std::vector<TrajectoryIndexEntry> index;
+};
+
+// Event Batch Struct
+// One record of an event file as the EventRecorder captured it: the state of every particle for a keyframe, the state of the particles added at the end for a spawn record, otherwise the events of one step.
+struct EventBatch {
+    enum class Kind { Keyframe, Spawn, Events };
+
+    double time = 0; // Simulated time in seconds
+    Kind kind = Kind::Events;
+    std::vector<float> x; // Keyframes and spawn records only
+    std::vector<float> y;
+    std::vector<float> vx;
+    std::vector<float> vy;
+    std::vector<float> radius;
+    std::vector<std::uint32_t> color;
+    std::vector<ParticleEvent> events; // Event batches only
+
+    // Memory the batch holds while it waits for the writer
+    size_t bytes() const {
+        return x.size() * (5 * sizeof(float) + sizeof(std::uint32_t)) + events.size() * sizeof(ParticleEvent);
+    }
+};
+
+// Event Segment Struct
+// A keyframe of an event file and the spawn records and event batches after it, up to the next keyframe, as found by readEventSegments.
+struct EventSegment {
+    uint64_t keyframeOffset; // Of the keyframe record, from the start of the file
+    uint64_t batchesOffset; // Of the first record after it
+    uint64_t end; // Of the segment
+    double startTime; // Time of the keyframe
+    double endTime; // Time of the last record
+    uint64_t particleCount; // At the end of the segment: those of the keyframe and of all spawn records
+    uint64_t eventCount;
+};
+
+// Event Index Struct
+// The first state and the events of a segment's particles, sorted by particle and then by time: entries first[i] to first[i + 1] - 1 belong to particle i, starting with its state in the keyframe or spawn record that added it. Between two entries a particle moves in a straight line, so its position at any time follows from a binary search over its own entries.
+// Particles added by spawn records only exist from then on: from visibleTime[k] on, the first visibleCount[k] particles exist.
+struct EventIndex {
+    std::vector<uint64_t> first;
+    std::vector<double> time;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> vx;
+    std::vector<float> vy;
+    std::vector<float> radius; // Per particle
+    std::vector<std::uint32_t> color;
+    std::vector<double> visibleTime;
+    std::vector<uint64_t> visibleCount;
+};
+
+// Trajectory Recorder Class
+// Records the positions and velocities of all particles every few steps to a trajectory file, for analysis after the run. record() runs on the simulation thread and only copies the particle arrays into a free frame of a small ring; a background thread quantizes and delta-encodes the frames and writes them. If the writer falls behind and the ring is full, the frame is dropped and counted instead of stalling the step.
+// Balls the update scheduler skips are recorded where they were last moved, up to maxLagDistance behind, as they are drawn.
+class TrajectoryRecorder {
+public:
+    TrajectoryRecorder() = default;
+    TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+    TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+    ~TrajectoryRecorder() {
+        stop();
+    }
+
+    // Starts recording every interval-th step to path, replacing the file and ending a running recording. Returns false if the file cannot be created.
+    bool start(const std::string& path, size_t interval) {
+        stop();
+        file = openTrajectoryFile(path, interval);
+        if (file == nullptr) {
+            return false;
+        }
+        this->interval = std::max<size_t>(interval, 1);
+        stepCount = 0;
+        framesSinceKeyframe = 0;
+        keyframeNeeded = true;
+        produced.store(0, std::memory_order_relaxed);
+        consumed.store(0, std::memory_order_relaxed);
+        recordedFrames.store(0, std::memory_order_relaxed);
+        droppedFrames.store(0, std::memory_order_relaxed);
+        failed.store(false, std::memory_order_relaxed);
+        stopping = false;
+        frames.resize(recorderRingSize);
+        writer = std::thread([this] { writeFrames(); });
+        return true;
+    }
+
+    // Writes the frames still in the ring and closes the file. Returns false if writing failed at some point.
+    bool stop() {
+        if (!writer.joinable()) {
+            return true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        writer.join();
+        if (std::fclose(file) != 0) {
+            failed.store(true, std::memory_order_relaxed);
+        }
+        file = nullptr;
+        return !failed.load(std::memory_order_relaxed);
+    }
+
+    bool isRecording() const {
+        return writer.joinable();
+    }
+
+    // Called after every step. On every interval-th one, copies the particles into the ring in parallel, or drops the frame if the ring is full.
+    // The frame is a keyframe every recorderKeyframeInterval frames and whenever particles were added, dropped or moved since the last one, so the changes in the other frames always refer to the same particle.
+    void record(const ParticleStore& particles, ThreadPool& pool, double time) {
+        if (!isRecording() || stepCount++ % interval != 0) {
+            return;
+        }
+        bool keyframe = keyframeNeeded || particles.layoutVersion != keyframeLayout || framesSinceKeyframe + 1 >= recorderKeyframeInterval;
+        size_t head = produced.load(std::memory_order_relaxed);
+        if (head - consumed.load(std::memory_order_acquire) == frames.size()) {
+            droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            keyframeNeeded = keyframe; // A dropped keyframe is made up for by the next frame
+            return;
+        }
+        TrajectoryFrame& frame = frames[head % frames.size()];
+        frame.step = stepCount - 1;
+        frame.time = time;
+        frame.keyframe = keyframe;
+        size_t count = particles.size();
+        frame.x.resize(count);
+        frame.y.resize(count);
+        frame.vx.resize(count);
+        frame.vy.resize(count);
+        frame.radius.resize(keyframe ? count : 0);
+        frame.color.resize(keyframe ? count : 0);
+        pool.parallelFor(0, count, particleChunkSize, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i = ChunkedArray<float>::chunkEnd(i)) {
+                size_t end = std::min(ChunkedArray<float>::chunkEnd(i), last);
+                std::copy(particles.x.pointer(i), particles.x.pointer(i) + (end - i), frame.x.data() + i);
+                std::copy(particles.y.pointer(i), particles.y.pointer(i) + (end - i), frame.y.data() + i);
+                std::copy(particles.vx.pointer(i), particles.vx.pointer(i) + (end - i), frame.vx.data() + i);
+                std::copy(particles.vy.pointer(i), particles.vy.pointer(i) + (end - i), frame.vy.data() + i);
+                if (frame.keyframe) {
+                    std::copy(particles.radius.pointer(i), particles.radius.pointer(i) + (end - i), frame.radius.data() + i);
+                    std::copy(particles.color.pointer(i), particles.color.pointer(i) + (end - i), frame.color.data() + i);
+                }
+            }
+            });
+        if (keyframe) {
+            keyframeLayout = particles.layoutVersion;
+            framesSinceKeyframe = 0;
+            keyframeNeeded = false;
+        }
+        else {
+            ++framesSinceKeyframe;
+        }
+        produced.store(head + 1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(mutex); // Pairs with the writer's wait, so the wakeup cannot be missed
+        }
+        wakeup.notify_one();
+    }
+
+    // Frames written to the file and frames dropped because the writer was behind, since the recording started
+    uint64_t getRecordedFrames() const {
+        return recordedFrames.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getDroppedFrames() const {
+        return droppedFrames.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::FILE* file = nullptr;
+    size_t interval = 1;
+    uint64_t stepCount = 0;
+    size_t framesSinceKeyframe = 0;
+    uint64_t keyframeLayout = 0; // layoutVersion of the particles at the last keyframe
+    bool keyframeNeeded = true;
+    std::vector<TrajectoryFrame> frames; // Ring of captured frames; produced and consumed count the frames put in and taken out
+    std::atomic<size_t> produced{ 0 };
+    std::atomic<size_t> consumed{ 0 };
+    std::atomic<uint64_t> recordedFrames{ 0 };
+    std::atomic<uint64_t> droppedFrames{ 0 };
+    std::atomic<bool> failed{ false }; // A write failed; later frames are dropped
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::thread writer;
+
+    // Writer thread: encodes and writes the frames in the order they were captured until stop() is called and the ring is empty, then appends the index.
+    void writeFrames() {
+        TrajectoryEncoder encoder;
+        encoder.offset = static_cast<uint64_t>(std::ftell(file));
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this] { return stopping || consumed.load(std::memory_order_relaxed) != produced.load(std::memory_order_acquire); });
+            }
+            size_t tail = consumed.load(std::memory_order_relaxed);
+            if (tail == produced.load(std::memory_order_acquire)) {
+                // Woken by stop() with nothing left to write
+                if (!failed.load(std::memory_order_relaxed) && !writeTrajectoryIndex(file, encoder)) {
+                    failed.store(true, std::memory_order_relaxed);
+                }
+                return;
+            }
+            if (!failed.load(std::memory_order_relaxed)) {
+                if (writeTrajectoryFrame(file, frames[tail % frames.size()], encoder)) {
+                    recordedFrames.fetch_add(1, std::memory_order_relaxed);
+                }
+                else {
+                    failed.store(true, std::memory_order_relaxed);
+                }
+            }
+            consumed.store(tail + 1, std::memory_order_release);
+        }
+    }
+};
+
+// Event Recorder Class
+// Records a run as the moments particles change course instead of as frames: a keyframe with the state of every particle, then the events the engines report where balls bounce (see EventLog), each with the exact time, position and new velocity. Between two events a particle moves in a straight line, so the file holds everything needed to place any particle at any time, at a small fraction of the size of a trajectory file. Positions the player computes from an event differ from the live run's step-by-step sums only by float rounding.
+// Particles added at the end get a spawn record with only their state; a keyframe is written at the start and whenever particles were dropped or moved to other indices.
+// A background thread writes the records. None is ever dropped, since a lost event would send its particle off course for the rest of the segment; if the writer falls behind by more than eventQueueBytes, the simulation thread waits for it.
+class EventRecorder {
+public:
+    EventRecorder() = default;
+    EventRecorder(const EventRecorder&) = delete;
+    EventRecorder& operator=(const EventRecorder&) = delete;
+
+    ~EventRecorder() {
+        stop();
+    }
+
+    // Starts recording to path, replacing the file and ending a running recording. Returns false if the file cannot be created.
+    bool start(const std::string& path) {
+        stop();
+        file = openEventFile(path);
+        if (file == nullptr) {
+            return false;
+        }
+        keyframeNeeded = true;
+        recordedCount = 0;
+        lastTime = 0;
+        writtenTime = 0;
+        recordedEvents = 0;
+        recordedKeyframes = 0;
+        recordedSpawns = 0;
+        pendingBytes = 0;
+        writtenBytes.store(0, std::memory_order_relaxed);
+        failed.store(false, std::memory_order_relaxed);
+        stopping = false;
+        log.take();
+        writer = std::thread([this] { writeBatches(); });
+        return true;
+    }
+
+    // Writes the batches still waiting and closes the file. An empty batch at the time of the last step marks where the recording ends, if no record did. Returns false if writing failed at some point.
+    bool stop() {
+        if (!writer.joinable()) {
+            return true;
+        }
+        if (!keyframeNeeded && lastTime > writtenTime) {
+            EventBatch batch;
+            batch.time = lastTime;
+            hand(std::move(batch));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        writer.join();
+        if (std::fclose(file) != 0) {
+            failed.store(true, std::memory_order_relaxed);
+        }
+        file = nullptr;
+        return !failed.load(std::memory_order_relaxed);
+    }
+
+    bool isRecording() const {
+        return writer.joinable();
+    }
+
+    // The log the engines report bounces to while recording, nullptr otherwise
+    EventLog* getLog() {
+        return isRecording() ? &log : nullptr;
+    }
+
+    // Whether the next capture() writes a keyframe: at the start, and after particles were dropped or moved to other indices. The balls the update scheduler skipped must be brought up to date before one.
+    bool needsKeyframe(const ParticleStore& particles) const {
+        return isRecording() && (keyframeNeeded || particles.reorderVersion != keyframeReorder || particles.size() < recordedCount);
+    }
+
+    // Called at the start of every step, after posted particles were added, with the time it starts at. Captures a keyframe if needsKeyframe(), otherwise a spawn record of the particles added since the last capture, if any.
+    void capture(const ParticleStore& particles, ThreadPool& pool, double time) {
+        if (!isRecording()) {
+            return;
+        }
+        EventBatch batch;
+        batch.time = time;
+        size_t first = recordedCount;
+        if (needsKeyframe(particles)) {
+            batch.kind = EventBatch::Kind::Keyframe;
+            first = 0;
+            log.take(); // The events so far belong to the old indices, or to nothing before the first keyframe
+            keyframeReorder = particles.reorderVersion;
+            keyframeNeeded = false;
+            ++recordedKeyframes;
+        }
+        else if (particles.size() > recordedCount) {
+            batch.kind = EventBatch::Kind::Spawn;
+            ++recordedSpawns;
+        }
+        else {
+            return;
+        }
+        size_t count = particles.size() - first;
+        batch.x.resize(count);
+        batch.y.resize(count);
+        batch.vx.resize(count);
+        batch.vy.resize(count);
+        batch.radius.resize(count);
+        batch.color.resize(count);
+        pool.parallelFor(first, particles.size(), physicsGrainSize, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                batch.x[i - first] = particles.x[i];
+                batch.y[i - first] = particles.y[i];
+                batch.vx[i - first] = particles.vx[i];
+                batch.vy[i - first] = particles.vy[i];
+                batch.radius[i - first] = particles.radius[i];
+                batch.color[i - first] = particles.color[i];
+            }
+            });
+        recordedCount = particles.size();
+        hand(std::move(batch));
+    }
+
+    // Called when a step or a flush of skipped balls ended, with the time it ended at: hands the events reported since the last commit to the writer as one batch.
+    void commit(double time) {
+        if (!isRecording()) {
+            return;
+        }
+        lastTime = time;
+        if (keyframeNeeded) {
+            log.take();
+            return;
+        }
+        EventBatch batch;
+        batch.time = time;
+        batch.events = log.take();
+        if (batch.events.empty()) {
+            return;
+        }
+        recordedEvents += batch.events.size();
+        hand(std::move(batch));
+    }
+
+    // Events, keyframes and spawn records captured since the recording started, and the size of the file so far
+    uint64_t getRecordedEvents() const {
+        return recordedEvents;
+    }
+
+    uint64_t getRecordedKeyframes() const {
+        return recordedKeyframes;
+    }
+
+    uint64_t getRecordedSpawns() const {
+        return recordedSpawns;
+    }
+
+    uint64_t getWrittenBytes() const {
+        return writtenBytes.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::FILE* file = nullptr;
+    EventLog log;
+    bool keyframeNeeded = true;
+    uint64_t keyframeReorder = 0; // reorderVersion of the particles at the last keyframe
+    size_t recordedCount = 0; // Particles in the last keyframe and the spawn records after it
+    double lastTime = 0; // Of the last commit
+    double writtenTime = 0; // Of the last record handed to the writer
+    uint64_t recordedEvents = 0;
+    uint64_t recordedKeyframes = 0;
+    uint64_t recordedSpawns = 0;
+    std::deque<EventBatch> pending; // Captured batches waiting for the writer, oldest first
+    size_t pendingBytes = 0; // What they hold
+    std::atomic<uint64_t> writtenBytes{ 0 };
+    std::atomic<bool> failed{ false }; // A write failed; later batches are dropped
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable wakeup; // The writer waits for batches
+    std::condition_variable drained; // The simulation thread waits for room in the queue
+
+    std::thread writer;
+
+    // Queues the batch for the writer, first waiting until it fits within eventQueueBytes. A batch larger than that on its own waits for an empty queue.
+    void hand(EventBatch batch) {
+        size_t bytes = batch.bytes();
+        writtenTime = batch.time;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            drained.wait(lock, [&] { return pendingBytes == 0 || pendingBytes + bytes <= eventQueueBytes; });
+            pendingBytes += bytes;
+            pending.push_back(std::move(batch));
+        }
+        wakeup.notify_one();
+    }
+
+    // Writer thread: writes the batches in the order they were captured until stop() is called and none is left.
+    void writeBatches() {
+        while (true) {
+            EventBatch batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this] { return stopping || !pending.empty(); });
+                if (pending.empty()) {
+                    return;
+                }
+                batch = std::move(pending.front());
+                pending.pop_front();
+            }
+            size_t bytes = batch.bytes();
+            if (!failed.load(std::memory_order_relaxed)) {
+                if (writeEventBatch(file, batch)) {
+                    writtenBytes.store(static_cast<uint64_t>(std::ftell(file)), std::memory_order_relaxed);
+                }
+                else {
+                    failed.store(true, std::memory_order_relaxed);
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pendingBytes -= bytes;
+            }
+            drained.notify_one();
+        }
+    }
+};
+
+// Trajectory Player Class
+// Plays back a trajectory file written by the TrajectoryRecorder or an event file written by the EventRecorder. The file is memory-mapped and only what is needed for the time shown is decoded.
+// Trajectory files are played frame by frame: seek() starts at the last keyframe before the requested time, or continues from the frame shown now when that is closer, as during normal playback. The blocks of a frame decode independently, so they are spread over the thread pool.
+// Event files are played at any time, not only at recorded steps: seek() indexes the segment the time falls into once (see EventIndex) and then places every particle that exists at that time with a binary search over its own events, in parallel.
+// The decoded particles are kept in a ParticleStore, so they are drawn like live ones. Their mass is not recorded and stays undefined.
+class TrajectoryPlayer {
+public:
+    static constexpr size_t noFrame = std::numeric_limits<size_t>::max();
+
+    // Opens the trajectory or event file at path, replacing the one open now. Prints the reason and returns false if it is missing or neither kind of file.
+    bool open(const std::string& path) {
+        close();
+        std::unique_ptr<MappedFile> mapped = std::make_unique<MappedFile>(path);
+        events = isEventFile(*mapped);
+        bool valid = events ? readEventSegments(path, *mapped, segments) : readTrajectoryIndex(path, *mapped, index, positionScale, velocityScale);
+        if (!valid) {
+            close();
+            return false;
+        }
+        file = std::move(mapped);
+        return true;
+    }
+
+    void close() {
+        file.reset();
+        index.clear();
+        current = noFrame;
+        events = false;
+        segments.clear();
+        eventIndex = EventIndex();
+        currentSegment = noFrame;
+        currentTime = 0;
+        particles.clear();
+    }
+
+    bool isOpen() const {
+        return file != nullptr;
+    }
+
+    double getStartTime() const {
+        if (events) {
+            return segments.empty() ? 0.0 : segments.front().startTime;
+        }
+        return index.empty() ? 0.0 : index.front().time;
+    }
+
+    double getEndTime() const {
+        if (events) {
+            return segments.empty() ? 0.0 : segments.back().endTime;
+        }
+        return index.empty() ? 0.0 : index.back().time;
+    }
+
+    // Simulated time of what is shown now
+    double getTime() const {
+        if (events) {
+            return currentSegment == noFrame ? getStartTime() : currentTime;
+        }
+        return current == noFrame ? getStartTime() : index[current].time;
+    }
+
+    const ParticleStore& getParticles() const {
+        return particles;
+    }
+
+    // Shows the last frame at or before time, or the first frame if time is before it. Event files show the particles at time itself, limited to the recorded span.
+    void seek(double time, ThreadPool& pool) {
+        if (events) {
+            seekEvents(time, pool);
+            return;
+        }
+        if (index.empty()) {
+            return;
+        }
+        size_t target = std::upper_bound(index.begin(), index.end(), time, [](double value, const TrajectoryIndexEntry& entry) { return value < entry.time; }) - index.begin();
+        target = target > 0 ? target - 1 : 0;
+        if (target == current) {
+            return;
+        }
+        size_t first = target;
+        while (first > 0 && (index[first].flags & trajectoryKeyframe) == 0) {
+            --first;
+        }
+        if (current != noFrame && current >= first && current < target) {
+            first = current + 1;
+        }
+
+        size_t count = index[target].particleCount;
+        if (particles.size() != count) {
+            particles.clear();
+            particles.grow(count, 0.0f);
+            x.resize(count);
+            y.resize(count);
+            vx.resize(count);
+            vy.resize(count);
+        }
+        size_t blockCount = (count + trajectoryBlockSize - 1) / trajectoryBlockSize;
+        pool.parallelFor(0, blockCount, 1, [&](size_t firstBlock, size_t lastBlock) {
+            for (size_t block = firstBlock; block < lastBlock; ++block) {
+                for (size_t frame = first; frame <= target; ++frame) {
+                    decodeTrajectoryBlock(*file, index[frame], block, x.data(), y.data(), vx.data(), vy.data(), particles);
+                }
+                // A block is one chunk of the particle arrays
+                size_t begin = block * trajectoryBlockSize;
+                size_t end = std::min(begin + trajectoryBlockSize, count);
+                float* blockX = particles.x.pointer(begin);
+                float* blockY = particles.y.pointer(begin);
+                float* blockVx = particles.vx.pointer(begin);
+                float* blockVy = particles.vy.pointer(begin);
+                for (size_t i = begin; i < end; ++i) {
+                    blockX[i - begin] = static_cast<float>(static_cast<double>(x[i]) / positionScale);
+                    blockY[i - begin] = static_cast<float>(static_cast<double>(y[i]) / positionScale);
+                    blockVx[i - begin] = static_cast<float>(static_cast<double>(vx[i]) / velocityScale);
+                    blockVy[i - begin] = static_cast<float>(static_cast<double>(vy[i]) / velocityScale);
+                }
+            }
+            });
+        current = target;
+    }
+
+private:
+    std::unique_ptr<MappedFile> file;
+    std::vector<TrajectoryIndexEntry> index;
+    float positionScale = 1.0f;
+    float velocityScale = 1.0f;
+    size_t current = noFrame; // Index entry of the frame shown
+    std::vector<int64_t> x; // Quantized values of the frame shown
+    std::vector<int64_t> y;
+    std::vector<int64_t> vx;
+    std::vector<int64_t> vy;
+    bool events = false; // The open file is an event file
+    std::vector<EventSegment> segments;
+    EventIndex eventIndex; // Of the segment shown
+    size_t currentSegment = noFrame;
+    double currentTime = 0;
+    ParticleStore particles;
+
+    // seek() for event files.
+    void seekEvents(double time, ThreadPool& pool) {
+        if (segments.empty()) {
+            return;
+        }
+        time = std::clamp(time, getStartTime(), getEndTime());
+        // A keyframe starts its segment at the end of the step before, which the segment before still shows
+        size_t target = std::lower_bound(segments.begin(), segments.end(), time, [](const EventSegment& segment, double value) { return segment.startTime < value; }) - segments.begin();
+        target = target > 0 ? target - 1 : 0;
+        if (target == currentSegment && time == currentTime) {
+            return;
+        }
+        if (target != currentSegment) {
+            indexEventSegment(*file, segments[target], eventIndex);
+            particles.clear();
+            currentSegment = target;
+        }
+        size_t spawn = std::upper_bound(eventIndex.visibleTime.begin(), eventIndex.visibleTime.end(), time) - eventIndex.visibleTime.begin();
+        size_t visible = eventIndex.visibleCount[spawn > 0 ? spawn - 1 : 0];
+        if (particles.size() != visible) {
+            particles.clear();
+            particles.grow(visible, 0.0f);
+            for (size_t i = 0; i < visible; i = particles.radius.chunkEnd(i)) {
+                size_t end = std::min(particles.radius.chunkEnd(i), visible);
+                std::copy(eventIndex.radius.begin() + i, eventIndex.radius.begin() + end, particles.radius.pointer(i));
+                std::copy(eventIndex.color.begin() + i, eventIndex.color.begin() + end, particles.color.pointer(i));
+            }
+        }
+
+        pool.parallelFor(0, particles.size(), particleChunkSize, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                // The last entry at or before time; the first one, the state the particle was added with, always is
+                const double* entries = eventIndex.time.data();
+                size_t entry = std::upper_bound(entries + eventIndex.first[i] + 1, entries + eventIndex.first[i + 1], time) - entries - 1;
+                float elapsed = static_cast<float>(time - eventIndex.time[entry]);
+                particles.x[i] = eventIndex.x[entry] + eventIndex.vx[entry] * elapsed;
+                particles.y[i] = eventIndex.y[entry] + eventIndex.vy[entry] * elapsed;
+                particles.vx[i] = eventIndex.vx[entry];
+                particles.vy[i] = eventIndex.vy[entry];
+            }
+            });
+        currentTime = time;
+    }
+};
+
+// Scenario Struct
+// A scene read from a scenario file by readScenario: walls, single balls and spawn batches in simulation coordinates, and the settings the file chose. Settings it leaves out are not set and keep their current values when the scenario is applied.
+struct Scenario {
+    std::vector<Wall> walls;
+    std::vector<Ball> balls;
+    std::vector<SpawnBatch> batches;
+    std::optional<bool> eventEngine;
+    std::optional<BroadphaseMode> broadphase;
+    std::optional<bool> ballCollisions;
+    std::optional<bool> levelOfDetail;
+    std::optional<float> stepLength; // Seconds per fixed physics step; the app and the headless runner own the step length
+};
+
+// Simulation Class
+// Owns the whole simulation state: the walls and their broadphase, the particles, the worker threads and both engines. It knows nothing about windows or drawing, so the interactive app and the headless runner step exactly the same code.
+class Simulation {
+public:
+    std::vector<Wall> walls;
+    WallBroadphase wallBroadphase;
+    ParticleStore particles;
+    ThreadPool threadPool;
+    BallGrid ballGrid;
+    EventEngine eventSimulation;
+    UpdateScheduler updateScheduler;
+    CommandQueue commands; // Spawns and walls posted from outside the step
+    TrajectoryRecorder recorder; // Records the particles after each step while it runs
+    EventRecorder eventRecorder; // Records the particles that changed course after each step while it runs
+    std::deque<SpawnBatch> spawning; // Spawn batches that are not fully generated yet, oldest first
+    size_t spawningDone = 0; // Balls of spawning.front() generated so far
+    std::atomic<size_t> spawnedCount{ 0 };
+    std::atomic<size_t> spawnTotal{ 0 };
+    sf::FloatRect area; // The balls bounce off the edges of this rectangle
+    double time = 0; // Simulated seconds so far
+    bool ballCollisions = true; // Whether balls bounce off each other
+    bool eventEngine = false; // Use the event-driven engine instead of stepping every ball
+    SimdLevel simdLevel = bestSimdLevel(); // Used by the frame-step engine while there are no walls
+    bool levelOfDetail = false; // Let the update scheduler skip balls whose motion does not need every step; only used while ball collisions are off, and only pays off for slow balls
+
+    Simulation(const sf::FloatRect& area, size_t workerThreads)
+        : wallBroadphase(BroadphaseMode::Grid, wallGridCellSize), threadPool(workerThreads, workerSpinCount), area(area) {}
+
+    // Adds walls and rebuilds what depends on them.
+    void addWalls(const std::vector<Wall>& newWalls) {
+        flush();
+        walls.insert(walls.end(), newWalls.begin(), newWalls.end());
+        wallBroadphase.build(walls, area);
+        eventSimulation.reset();
+    }
+
+    // Queues balls and walls to be added at the start of the next step. Never blocks, and can be called from any thread, also while a step runs.
+    void post(std::vector<Ball> newBalls, std::vector<Wall> newWalls = {}) {
+        CommandQueue::Command command;
+        command.balls = std::move(newBalls);
+        command.walls = std::move(newWalls);
+        commands.post(std::move(command));
+    }
+
+    // Queues a spawn batch. Each step generates at most spawnSliceSize balls of the batches in order, so a huge batch comes alive over several steps.
+    void post(const SpawnBatch& batch) {
+        CommandQueue::Command command;
+        command.batches.push_back(batch);
+        commands.post(std::move(command));
+    }
+
+    // Queues the removal of particles, by handle or by the area their center is in. Handles that went stale in the meantime are ignored.
+    void postRemoval(std::vector<ParticleHandle> removals, std::vector<sf::FloatRect> clearedAreas = {}) {
+        CommandQueue::Command command;
+        command.removals = std::move(removals);
+        command.clearedAreas = std::move(clearedAreas);
+        commands.post(std::move(command));
+    }
+
+    // Stops the spawn batches posted so far; the balls already generated stay.
+    void cancelSpawns() {
+        CommandQueue::Command command;
+        command.cancelSpawns = true;
+        commands.post(std::move(command));
+    }
+
+    // Progress of the spawn batches: balls generated and balls in all batches since the last time none were running. Both are 0 when idle; can be read from any thread.
+    size_t getSpawnedCount() const {
+        return spawnedCount.load(std::memory_order_relaxed);
+    }
+
+    size_t getSpawnTotal() const {
+        return spawnTotal.load(std::memory_order_relaxed);
+    }
+
+    // Adds everything posted so far (all new walls with one broadphase rebuild, then the new balls) and the next slice of the running spawn batches. Spawn batches are generated in parallel. Removals are applied first, followed by one compaction.
+    void applyCommands() {
+        if (!commands.empty()) {
+            std::vector<Wall> newWalls;
+            std::vector<Ball> newBalls;
+            std::vector<ParticleHandle> removals;
+            std::vector<sf::FloatRect> clearedAreas;
+            commands.drain([&](CommandQueue::Command& command) {
+                removals.insert(removals.end(), command.removals.begin(), command.removals.end());
+                clearedAreas.insert(clearedAreas.end(), command.clearedAreas.begin(), command.clearedAreas.end());
+                newWalls.insert(newWalls.end(), command.walls.begin(), command.walls.end());
+                if (newBalls.empty()) {
+                    newBalls = std::move(command.balls);
+                }
+                else {
+                    newBalls.insert(newBalls.end(), command.balls.begin(), command.balls.end());
+                }
+                if (command.cancelSpawns) {
+                    // The progress and counts belong to the cancelled batches; batches posted after the cancel start afresh
+                    spawning.clear();
+                    spawningDone = 0;
+                    spawnedCount.store(0, std::memory_order_relaxed);
+                    spawnTotal.store(0, std::memory_order_relaxed);
+                }
+                for (const SpawnBatch& batch : command.batches) {
+                    spawning.push_back(batch);
+                    spawnTotal.fetch_add(batch.count, std::memory_order_relaxed);
+                }
+                });
+            if (!removals.empty() || !clearedAreas.empty()) {
+                flush();
+                for (ParticleHandle particle : removals) {
+                    particles.remove(particle);
+                }
+                if (!clearedAreas.empty()) {
+                    // One parallel pass over the balls tests them against every area; remove() is not thread-safe, so each chunk only collects its hits, and they are removed in order afterwards
+                    size_t count = particles.size();
+                    std::vector<std::vector<size_t>> hits((count + compactGrainSize - 1) / compactGrainSize);
+                    threadPool.parallelFor(0, hits.size(), 1, [&](size_t firstChunk, size_t lastChunk) {
+                        for (size_t chunk = firstChunk; chunk < lastChunk; ++chunk) {
+                            size_t end = std::min((chunk + 1) * compactGrainSize, count);
+                            for (size_t i = chunk * compactGrainSize; i < end; ++i) {
+                                float centerX = particles.x[i] + particles.radius[i];
+                                float centerY = particles.y[i] + particles.radius[i];
+                                for (const sf::FloatRect& clearedArea : clearedAreas) {
+                                    if (clearedArea.contains(centerX, centerY)) {
+                                        hits[chunk].push_back(i);
+                                        break;
+                                    }
+                                }
+                            }
+                        }
+                        });
+                    for (const std::vector<size_t>& chunkHits : hits) {
+                        for (size_t i : chunkHits) {
+                            particles.remove(i);
+                        }
+                    }
+                }
+            }
+            if (!newWalls.empty()) {
+                addWalls(newWalls);
+            }
+
+            // Spawn batches are not reserved for here: the chunks of the store never move, so each slice allocates only the chunks it fills
+            particles.append(newBalls);
+        }
+        if (particles.removedCount > 0) {
+            compact();
+        }
+        spawnSlice();
+    }
+
+    // Removes all walls and particles, stops the spawn batches and drops whatever was posted but not applied yet.
+    void clear() {
+        commands.drain([](CommandQueue::Command&) {});
+        spawning.clear();
+        spawningDone = 0;
+        spawnedCount.store(0, std::memory_order_relaxed);
+        spawnTotal.store(0, std::memory_order_relaxed);
+        walls.clear();
+        wallBroadphase.build(walls, area);
+        particles.clear();
+        updateScheduler.reset();
+        eventSimulation.reset();
+    }
+
+    // Drops the removed particles. The per-ball state of both engines is indexed by position in the store, so it is rebuilt from the current state.
+    void compact() {
+        flush();
+        compactParticles(particles, threadPool);
+        updateScheduler.reset();
+        eventSimulation.reset();
+    }
+
+    void setBroadphaseMode(BroadphaseMode mode) {
+        wallBroadphase.setMode(mode, walls, area);
+    }
+
+    void setEventEngine(bool enabled) {
+        flush();
+        eventEngine = enabled;
+        eventSimulation.reset();
+    }
+
+    // Advances the simulation by one physics step: posted balls and walls are added first, then ball-ball collisions, then movement with boundary and wall collisions. The event-driven engine only handles the boundary and walls. Running recordings get the result: the event recorder gets the particles added at the start of the step and the bounces of the step at its end.
+    void step(float deltaTime) {
+        applyCommands();
+        if (eventRecorder.needsKeyframe(particles)) {
+            // The keyframe holds every ball where it is, so the bounces on the way there are not recorded
+            updateScheduler.flush(particles, area, walls, wallBroadphase, threadPool, simdLevel);
+        }
+        eventRecorder.capture(particles, threadPool, time);
+        advance(deltaTime);
+        time += deltaTime;
+        eventRecorder.commit(time);
+        recorder.record(particles, threadPool, time);
+    }
+
+    // Moves the particles by deltaTime with the selected engine, reporting the bounces to the event recorder while it runs.
+    void advance(float deltaTime) {
+        EventLog* log = eventRecorder.getLog();
+        if (eventEngine) {
+            eventSimulation.advance(particles, area, walls, wallBroadphase, deltaTime, threadPool, log);
+            return;
+        }
+        // Without walls the vectorized integration of every ball is cheaper than deciding which ones to skip, and with ball collisions the collision pass already touches every ball each step, so skipping saves less than the bookkeeping costs
+        bool scheduled = levelOfDetail && !ballCollisions && !walls.empty();
+        if (!scheduled) {
+            flush();
+        }
+        if (ballCollisions) {
+            resolveBallCollisions(particles, area, ballGrid, threadPool, log, -deltaTime);
+        }
+        if (scheduled) {
+            updateScheduler.step(particles, area, walls, wallBroadphase, deltaTime, threadPool, simdLevel, log);
+            return;
+        }
+        updateBallsInParallel(particles, area, walls, wallBroadphase, deltaTime, threadPool, simdLevel, log);
+    }
+
+    // Generates the next spawnSliceSize balls of the running spawn batches.
+    void spawnSlice() {
+        size_t budget = spawnSliceSize;
+        while (budget > 0 && !spawning.empty()) {
+            const SpawnBatch& batch = spawning.front();
+            size_t first = spawningDone;
+            size_t last = std::min(batch.count, first + budget);
+            size_t at = particles.size();
+            particles.grow(last - first, batch.radius);
+            threadPool.parallelFor(first, last, spawnGrainSize, [&](size_t chunkFirst, size_t chunkLast) {
+                spawnBalls(particles, at + (chunkFirst - first), batch, chunkFirst, chunkLast, simdLevel);
+                });
+            budget -= last - first;
+            spawnedCount.fetch_add(last - first, std::memory_order_relaxed);
+            spawningDone = last;
+            if (spawningDone == batch.count) {
+                spawning.pop_front();
+                spawningDone = 0;
+            }
+        }
+        if (spawning.empty()) {
+            spawningDone = 0;
+            spawnedCount.store(0, std::memory_order_relaxed);
+            spawnTotal.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Brings the balls the update scheduler skipped to their current positions. step() leaves them up to maxLagDistance behind, which is fine for drawing but not for comparing states. The event recorder gets their bounces right away.
+    void flush() {
+        updateScheduler.flush(particles, area, walls, wallBroadphase, threadPool, simdLevel, eventRecorder.getLog());
+        eventRecorder.commit(time);
+    }
+};
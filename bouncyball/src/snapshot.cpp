@@ -0,0 +1,220 @@
+#include "simulation.h"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <bit>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Snapshots: the walls and the state of every particle in one binary file, to save a scene and restore it later.
+// Layout: a SnapshotHeader, the walls as start x, start y, end x, end y floats, then the particle arrays x, y, vx, vy, radius, mass and color one after another, each starting at a multiple of snapshotAlignment bytes. Values are stored as they are in memory (little-endian IEEE floats), so saving writes the arrays as they are and loading copies them straight into the particle store.
+// Handles are not saved; the restored particles get new ones.
+
+static_assert(std::endian::native == std::endian::little, "snapshots are stored little-endian");
+
+const char snapshotMagic[8] = { 'B', 'B', 'S', 'N', 'A', 'P', '\r', '\n' }; // The line break catches files mangled by text-mode transfers
+const uint32_t snapshotVersion = 1;
+const uint64_t snapshotAlignment = 64;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t wallCount;
+    uint64_t particleCount;
+    float maxRadius;
+    uint32_t reserved[7];
+};
+static_assert(sizeof(SnapshotHeader) == snapshotAlignment, "the header fills the first aligned block");
+
+// Particle arrays in file order
+const size_t snapshotArrayCount = 7;
+
+// File offsets of the particle arrays and the size of the whole file
+struct SnapshotLayout {
+    uint64_t arrays[snapshotArrayCount];
+    uint64_t fileSize;
+
+    SnapshotLayout(uint64_t wallCount, uint64_t particleCount) {
+        uint64_t offset = sizeof(SnapshotHeader) + wallCount * 4 * sizeof(float);
+        for (size_t i = 0; i < snapshotArrayCount; ++i) {
+            offset = (offset + snapshotAlignment - 1) / snapshotAlignment * snapshotAlignment;
+            arrays[i] = offset;
+            offset += particleCount * sizeof(float);
+        }
+        fileSize = offset;
+    }
+};
+
+// Calls function(array, index) for each particle array, in file order. All of them hold 4-byte values.
+template <typename Store, typename Function>
+static void forEachSnapshotArray(Store& particles, Function&& function) {
+    function(particles.x, 0);
+    function(particles.y, 1);
+    function(particles.vx, 2);
+    function(particles.vy, 3);
+    function(particles.radius, 4);
+    function(particles.mass, 5);
+    function(particles.color, 6);
+}
+
+// Maps the whole file; leaves data nullptr if that fails.
+MappedFile::MappedFile(const std::string& path) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr) {
+            data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            size = data != nullptr ? static_cast<size_t>(fileSize.QuadPart) : 0;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        return;
+    }
+    struct stat status;
+    if (fstat(file, &status) == 0 && status.st_size > 0) {
+        void* mapped = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapped != MAP_FAILED) {
+            data = static_cast<const char*>(mapped);
+            size = static_cast<size_t>(status.st_size);
+        }
+    }
+    close(file);
+#endif
+}
+
+MappedFile::~MappedFile() {
+    if (data == nullptr) {
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(data);
+#else
+    munmap(const_cast<char*>(data), size);
+#endif
+}
+
+// Writes the walls and particles of the simulation to path, replacing the file. The balls the update scheduler skipped are brought up to date first, and removed particles are dropped. Prints the reason and returns false if the file cannot be written.
+bool saveSnapshot(Simulation& simulation, const std::string& path) {
+    simulation.flush();
+    if (simulation.particles.removedCount > 0) {
+        simulation.compact();
+    }
+    const ParticleStore& particles = simulation.particles;
+
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Cannot create snapshot file " << path << std::endl;
+        return false;
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+    header.version = snapshotVersion;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.wallCount = simulation.walls.size();
+    header.particleCount = particles.size();
+    header.maxRadius = particles.maxRadius;
+    SnapshotLayout layout(header.wallCount, header.particleCount);
+
+    std::vector<float> wallValues;
+    wallValues.reserve(simulation.walls.size() * 4);
+    for (const Wall& wall : simulation.walls) {
+        wallValues.insert(wallValues.end(), { wall.start.x, wall.start.y, wall.end.x, wall.end.y });
+    }
+
+    // One write per chunk of each array, with zero padding up to the next array
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    written = written && std::fwrite(wallValues.data(), sizeof(float), wallValues.size(), file) == wallValues.size();
+    uint64_t offset = sizeof(header) + wallValues.size() * sizeof(float);
+    const char padding[snapshotAlignment] = {};
+    forEachSnapshotArray(particles, [&](const auto& values, size_t array) {
+        written = written && std::fwrite(padding, 1, layout.arrays[array] - offset, file) == layout.arrays[array] - offset;
+        for (size_t i = 0; i < values.size() && written; i = values.chunkEnd(i)) {
+            size_t count = std::min(values.chunkEnd(i), values.size()) - i;
+            written = std::fwrite(values.pointer(i), sizeof(float), count, file) == count;
+        }
+        offset = layout.arrays[array] + values.size() * sizeof(float);
+        });
+    written = std::fclose(file) == 0 && written;
+    if (!written) {
+        std::cerr << "Cannot write snapshot file " << path << std::endl;
+        std::remove(path.c_str());
+    }
+    return written;
+}
+
+// Replaces the walls and particles of the simulation with those saved in path, dropping running spawn batches and anything posted but not applied yet. The particle arrays are copied from the mapped file in parallel, one chunk per work item. Prints the reason and returns false, leaving the simulation as it was, if the file is missing or not a valid snapshot.
+bool loadSnapshot(Simulation& simulation, const std::string& path) {
+    MappedFile file(path);
+#if !defined(_WIN32)
+    if (file.data != nullptr) {
+        madvise(const_cast<char*>(file.data), file.size, MADV_WILLNEED); // The whole file is copied, so start reading ahead right away
+    }
+#endif
+    if (file.data == nullptr) {
+        std::cerr << "Cannot open snapshot file " << path << std::endl;
+        return false;
+    }
+    SnapshotHeader header;
+    if (file.size < sizeof(header)) {
+        std::cerr << path << " is not a snapshot" << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.data, sizeof(header));
+    if (std::memcmp(header.magic, snapshotMagic, sizeof(header.magic)) != 0) {
+        std::cerr << path << " is not a snapshot" << std::endl;
+        return false;
+    }
+    if (header.version != snapshotVersion || header.headerSize != sizeof(SnapshotHeader)) {
+        std::cerr << path << " has snapshot version " << header.version << ", expected " << snapshotVersion << std::endl;
+        return false;
+    }
+    // Counts this large would overflow the layout; no file that size can exist anyway
+    const uint64_t countLimit = uint64_t(1) << 40;
+    if (header.wallCount > countLimit || header.particleCount > countLimit || SnapshotLayout(header.wallCount, header.particleCount).fileSize != file.size) {
+        std::cerr << "Snapshot file " << path << " is truncated or damaged" << std::endl;
+        return false;
+    }
+    SnapshotLayout layout(header.wallCount, header.particleCount);
+
+    std::vector<Wall> walls;
+    walls.reserve(header.wallCount);
+    const char* wallData = file.data + sizeof(header);
+    for (uint64_t i = 0; i < header.wallCount; ++i) {
+        float values[4];
+        std::memcpy(values, wallData + i * sizeof(values), sizeof(values));
+        walls.emplace_back(sf::Vector2f(values[0], values[1]), sf::Vector2f(values[2], values[3]));
+    }
+
+    simulation.clear();
+    simulation.addWalls(walls);
+    ParticleStore& particles = simulation.particles;
+    particles.grow(header.particleCount, header.maxRadius);
+    simulation.threadPool.parallelFor(0, particles.size(), particleChunkSize, [&](size_t first, size_t last) {
+        forEachSnapshotArray(particles, [&](auto& values, size_t array) {
+            for (size_t i = first; i < last; i = values.chunkEnd(i)) {
+                size_t count = std::min(values.chunkEnd(i), last) - i;
+                std::memcpy(values.pointer(i), file.data + layout.arrays[array] + i * sizeof(float), count * sizeof(float));
+            }
+            });
+        });
+    return true;
+}
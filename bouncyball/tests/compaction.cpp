@@ -0,0 +1,105 @@
+#include "testing.h"
+
+// Compaction test: compactParticles must keep the survivors in their order, with every array moved alike, and every handle must still find its particle (or report it removed) when the removals span several chunks. Run with and without worker threads, since the scatter runs in parallel.
+
+// Fills particle i with values that tell where it came from: x is its original index
+static void fill(ParticleStore& particles, size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+        particles.x[i] = static_cast<float>(i);
+        particles.y[i] = -static_cast<float>(i);
+        particles.vx[i] = static_cast<float>(i) * 0.5f;
+        particles.vy[i] = static_cast<float>(i) * 0.25f;
+        particles.radius[i] = static_cast<float>(i % 7 + 1);
+        particles.mass[i] = static_cast<float>(i % 5 + 1);
+        particles.color[i] = static_cast<uint32_t>(i) * 3;
+    }
+}
+
+// Removes the particles for which removed(original index) holds, compacts, and checks the result against the handles taken before
+template <typename Removed>
+static void compactAndCheck(ParticleStore& particles, ThreadPool& pool, Removed removed, const std::string& name) {
+    std::vector<ParticleHandle> handles;
+    std::vector<size_t> original;
+    for (size_t i = 0; i < particles.size(); ++i) {
+        handles.push_back(particles.handle(i));
+        original.push_back(static_cast<size_t>(particles.x[i]));
+    }
+    size_t survivors = 0;
+    for (size_t i = 0; i < particles.size(); ++i) {
+        if (removed(original[i])) {
+            particles.remove(i);
+        }
+        else {
+            ++survivors;
+        }
+    }
+    uint64_t layoutVersion = particles.layoutVersion;
+    compactParticles(particles, pool);
+
+    check(particles.size() == survivors, name + ": wrong particle count after compaction");
+    check(particles.removedCount == 0 && particles.layoutVersion != layoutVersion, name + ": compaction left removal marks or kept the layout version");
+    for (ChunkedArray<float>* values : { &particles.y, &particles.vx, &particles.vy, &particles.radius, &particles.mass }) {
+        check(values->size() == survivors, name + ": arrays of different sizes after compaction");
+    }
+    check(particles.color.size() == survivors && particles.slot.size() == survivors, name + ": arrays of different sizes after compaction");
+
+    size_t next = 0;
+    for (size_t before = 0; before < handles.size(); ++before) {
+        size_t index = particles.indexOf(handles[before]);
+        if (removed(original[before])) {
+            check(index == particles.size(), name + ": handle of removed particle " + std::to_string(original[before]) + " still resolves");
+            continue;
+        }
+        if (!check(index == next, name + ": particle " + std::to_string(original[before]) + " is at " + std::to_string(index) + ", expected " + std::to_string(next))) {
+            return;
+        }
+        float i = static_cast<float>(original[before]);
+        size_t k = original[before];
+        bool same = particles.x[index] == i && particles.y[index] == -i && particles.vx[index] == i * 0.5f && particles.vy[index] == i * 0.25f &&
+            particles.radius[index] == static_cast<float>(k % 7 + 1) && particles.mass[index] == static_cast<float>(k % 5 + 1) && particles.color[index] == static_cast<uint32_t>(k) * 3;
+        if (!check(same, name + ": the values of particle " + std::to_string(k) + " were not moved together")) {
+            return;
+        }
+        ++next;
+    }
+}
+
+int main() {
+    const size_t chunk = particleChunkSize;
+    for (size_t workers : { 0, 3 }) {
+        ThreadPool pool(workers, workerSpinCount);
+        std::string threads = std::to_string(workers + 1) + " threads";
+
+        ParticleStore particles;
+        size_t count = 5 * chunk + 1234;
+        particles.grow(count, 7.0f);
+        fill(particles, 0, count);
+
+        // The first chunk stays in place; every third particle of the second chunk, all of the third and a few of the last go
+        compactAndCheck(particles, pool, [chunk](size_t i) {
+            return (i >= chunk && i < 2 * chunk && i % 3 == 0) || (i >= 2 * chunk && i < 3 * chunk) || (i >= 5 * chunk && i % 100 == 1);
+            }, "removals from the second chunk on, " + threads);
+
+        // Particles added after a compaction land in the reused chunks and compact like the others, including the very first and last one
+        size_t oldSize = particles.size();
+        particles.grow(2 * chunk, 7.0f);
+        for (size_t i = oldSize; i < particles.size(); ++i) {
+            particles.x[i] = static_cast<float>(count + i);
+            particles.y[i] = -static_cast<float>(count + i);
+            particles.vx[i] = static_cast<float>(count + i) * 0.5f;
+            particles.vy[i] = static_cast<float>(count + i) * 0.25f;
+            particles.radius[i] = static_cast<float>((count + i) % 7 + 1);
+            particles.mass[i] = static_cast<float>((count + i) % 5 + 1);
+            particles.color[i] = static_cast<uint32_t>(count + i) * 3;
+        }
+        size_t last = count + particles.size() - 1;
+        compactAndCheck(particles, pool, [last](size_t i) {
+            return i == 0 || i == last || i % 5 == 2;
+            }, "removals in every chunk, " + threads);
+
+        // Everything removed
+        compactAndCheck(particles, pool, [](size_t) { return true; }, "all removed, " + threads);
+        check(particles.empty(), "store not empty after removing everything");
+    }
+    return failures();
+}
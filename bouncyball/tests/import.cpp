@@ -0,0 +1,124 @@
+#include "testing.h"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+
+// Import test: the same records imported from a CSV file and from a binary file must give the same particles, with the values the Ball constructor gives them, added after those already there. A file with an invalid record must be refused with its line or record number and leave the particles as they were.
+
+const std::string csvPath = "test_import.csv";
+const std::string binaryPath = "test_import.bin";
+const float importRadius = 2.0f;
+const std::uint32_t importColor = 0x4080C0FF;
+
+// One record of an import file
+struct Record {
+    float x, y, angle, speed;
+};
+
+static void writeCsv(const std::vector<Record>& records, const std::string& extra = "") {
+    std::ofstream file(csvPath, std::ios::binary);
+    file << "x, y, angle, speed\r\n";
+    char line[128];
+    for (size_t i = 0; i < records.size(); ++i) {
+        const Record& record = records[i];
+        std::snprintf(line, sizeof(line), "%.9g,%.9g, %.9g ,%.9g%s", record.x, record.y, record.angle, record.speed, i % 3 == 0 ? "\r\n" : "\n");
+        file << line;
+        if (i % 1000 == 0) {
+            file << "\n"; // Blank lines are skipped
+        }
+    }
+    file << extra;
+}
+
+static void writeBinary(const std::vector<Record>& records) {
+    std::ofstream file(binaryPath, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+}
+
+// Imports path into a scene of a few balls and returns whether it was accepted, with what was printed to std::cerr in errors
+static bool importInto(Simulation& simulation, const std::string& path, std::string& errors) {
+    std::ostringstream printed;
+    std::streambuf* previous = std::cerr.rdbuf(printed.rdbuf());
+    bool imported = importParticles(simulation, path, importRadius, importColor);
+    std::cerr.rdbuf(previous);
+    errors = printed.str();
+    return imported;
+}
+
+int main() {
+    // Enough records for several CSV pieces and several chunks of the particle arrays
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> randomX(0.0f, static_cast<float>(SIMULATION_WIDTH));
+    std::uniform_real_distribution<float> randomY(0.0f, static_cast<float>(SIMULATION_HEIGHT));
+    std::uniform_real_distribution<float> randomAngle(-360.0f, 720.0f);
+    std::uniform_real_distribution<float> randomSpeed(0.0f, 500.0f);
+    std::vector<Record> records(100000);
+    for (Record& record : records) {
+        record = { randomX(random), randomY(random), randomAngle(random), randomSpeed(random) };
+    }
+    records[0] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    records[1] = { static_cast<float>(SIMULATION_WIDTH), static_cast<float>(SIMULATION_HEIGHT), -90.0f, 1e-30f };
+    writeCsv(records);
+    writeBinary(records);
+
+    Simulation fromCsv(sf::FloatRect(0, 0, SIMULATION_WIDTH, SIMULATION_HEIGHT), 0);
+    Simulation fromBinary(sf::FloatRect(0, 0, SIMULATION_WIDTH, SIMULATION_HEIGHT), 0);
+    buildTestScene(fromCsv, 300, 10, 4);
+    buildTestScene(fromBinary, 300, 10, 4);
+    std::vector<uint32_t> scene = particleState(fromCsv.particles);
+    std::string errors;
+    check(importInto(fromCsv, csvPath, errors) && errors.empty(), "the CSV import was refused: " + errors);
+    check(importInto(fromBinary, binaryPath, errors) && errors.empty(), "the binary import was refused: " + errors);
+    check(particleState(fromCsv.particles) == particleState(fromBinary.particles), "the CSV and binary imports of the same records differ");
+
+    // The scene is kept and the records follow it in file order, as the Ball constructor builds them
+    const ParticleStore& particles = fromBinary.particles;
+    if (check(particles.size() == 300 + records.size(), "the import added " + std::to_string(particles.size() - 300) + " balls, not " + std::to_string(records.size()))) {
+        std::vector<uint32_t> imported = particleState(particles);
+        check(std::equal(scene.begin(), scene.end(), imported.begin()), "the import changed the balls already there");
+        ParticleStore expected;
+        for (const Record& record : records) {
+            expected.push_back(Ball(record.x, record.y, importRadius, importColor, record.speed, record.angle));
+        }
+        std::vector<uint32_t> built = particleState(expected);
+        check(std::equal(built.begin(), built.end(), imported.begin() + scene.size()), "imported balls differ from those the Ball constructor builds");
+    }
+
+    // An invalid record is reported with its line or record number and nothing is added
+    Simulation simulation(sf::FloatRect(0, 0, SIMULATION_WIDTH, SIMULATION_HEIGHT), 0);
+    buildTestScene(simulation, 300, 10, 4);
+    std::vector<ParticleHandle> handles;
+    for (size_t i = 0; i < simulation.particles.size(); ++i) {
+        handles.push_back(simulation.particles.handle(i));
+    }
+    const float maxRadius = simulation.particles.maxRadius;
+    writeCsv(records, "1, 2, 3\n4, 5, 6, 7\n");
+    size_t badLine = 1 + records.size() + (records.size() + 999) / 1000 + 1;
+    check(!importInto(simulation, csvPath, errors) && errors.rfind(csvPath + ":" + std::to_string(badLine) + ": ", 0) == 0,
+        "a CSV record with three values was reported as \"" + errors + "\", not at line " + std::to_string(badLine));
+    std::vector<Record> invalid = records;
+    invalid[70000].speed = -1.0f;
+    writeBinary(invalid);
+    check(!importInto(simulation, binaryPath, errors) && errors.find("invalid record 70001,") != std::string::npos,
+        "a binary record with a negative speed was reported as \"" + errors + "\"");
+    check(particleState(simulation.particles) == scene && simulation.particles.maxRadius == maxRadius, "a refused import changed the particles");
+    bool valid = true;
+    for (size_t i = 0; i < handles.size(); ++i) {
+        valid = valid && simulation.particles.indexOf(handles[i]) == i;
+    }
+    check(valid, "a refused import broke the handles of the balls already there");
+
+    // The scene runs on as if nothing had been imported
+    Simulation untouched(sf::FloatRect(0, 0, SIMULATION_WIDTH, SIMULATION_HEIGHT), 0);
+    buildTestScene(untouched, 300, 10, 4);
+    for (int step = 0; step < 20; ++step) {
+        simulation.step(1.0f / 120.0f);
+        untouched.step(1.0f / 120.0f);
+    }
+    check(particleState(simulation.particles) == particleState(untouched.particles), "after a refused import the scene runs differently");
+    check(importInto(simulation, binaryPath + ".missing", errors) == false && !errors.empty(), "a missing import file was not reported");
+
+    std::remove(csvPath.c_str());
+    std::remove(binaryPath.c_str());
+    return failures();
+}
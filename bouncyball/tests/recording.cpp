@@ -0,0 +1,186 @@
+#include "testing.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+// Recording test: a trajectory file read back with the TrajectoryPlayer must show the particles of the live run at each recorded step, to within the quantization of the file, also across the keyframes forced by spawns and removals. Seeking back and forth in random order must show the same as playing forward. An event file must show the live run at every step up to float rounding, whichever engine stepped it.
+
+const float stepTime = 1.0f / 120.0f;
+const int stepCount = 150;
+const float positionTolerance = 0.5f / 256.0f + 1e-4f; // Half a quantization step of the trajectory file, plus float rounding
+const float velocityTolerance = 0.5f / 256.0f + 1e-4f;
+const float eventPositionTolerance = 1e-2f; // The live run adds up a step at a time what the player computes in one go from the last bounce
+const float eventVelocityTolerance = 1e-4f;
+
+// Positions and velocities of the live run after one step, with balls the update scheduler skipped where they are by now
+struct LiveFrame {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> vx;
+    std::vector<float> vy;
+};
+
+// Runs a scene with spawns and removals part way through, recording with start(simulation) and ending with finish(simulation), and returns the particles after every step by simulated time
+template <typename Start, typename Finish>
+static std::map<double, LiveFrame> runScene(Start start, Finish finish) {
+    Simulation simulation(sf::FloatRect(0, 0, SIMULATION_WIDTH, SIMULATION_HEIGHT), 0);
+    buildTestScene(simulation, 2000, 100, 7);
+    start(simulation);
+    std::map<double, LiveFrame> live;
+    for (int step = 0; step < stepCount; ++step) {
+        if (step == 40) {
+            SpawnBatch batch;
+            batch.count = 500;
+            batch.startPosition = sf::Vector2f(100.0f, 100.0f);
+            batch.endPosition = sf::Vector2f(900.0f, 500.0f);
+            batch.endAngle = 360.0f;
+            batch.startSpeed = 100.0f;
+            batch.endSpeed = 300.0f;
+            simulation.post(batch);
+        }
+        if (step == 90) {
+            std::vector<ParticleHandle> removals;
+            for (size_t i = 0; i < simulation.particles.size(); i += 4) {
+                removals.push_back(simulation.particles.handle(i));
+            }
+            simulation.postRemoval(std::move(removals));
+        }
+        simulation.step(stepTime);
+        const ParticleStore& particles = simulation.particles;
+        LiveFrame& frame = live[simulation.time];
+        for (size_t i = 0; i < particles.size(); ++i) {
+            sf::Vector2f position = simulation.updateScheduler.currentPosition(particles, i);
+            frame.x.push_back(position.x);
+            frame.y.push_back(position.y);
+            frame.vx.push_back(particles.vx[i]);
+            frame.vy.push_back(particles.vy[i]);
+        }
+    }
+    finish(simulation);
+    return live;
+}
+
+// Compares what the player shows with the live frame at its time
+static bool matchesLive(const TrajectoryPlayer& player, const std::map<double, LiveFrame>& live, const std::string& name, float positionTolerance = ::positionTolerance,
+    float velocityTolerance = ::velocityTolerance) {
+    auto found = live.find(player.getTime());
+    if (!check(found != live.end(), name + ": the player shows a time the run never had")) {
+        return false;
+    }
+    const LiveFrame& frame = found->second;
+    const ParticleStore& particles = player.getParticles();
+    if (!check(particles.size() == frame.x.size(), name + ": wrong particle count at time " + std::to_string(player.getTime()))) {
+        return false;
+    }
+    for (size_t i = 0; i < particles.size(); ++i) {
+        bool close = std::abs(particles.x[i] - frame.x[i]) <= positionTolerance && std::abs(particles.y[i] - frame.y[i]) <= positionTolerance &&
+            std::abs(particles.vx[i] - frame.vx[i]) <= velocityTolerance && std::abs(particles.vy[i] - frame.vy[i]) <= velocityTolerance;
+        if (!check(close, name + ": particle " + std::to_string(i) + " differs from the live run at time " + std::to_string(player.getTime()))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    const std::string path = "test_trajectory.bbtraj";
+    uint64_t recordedFrames = 0;
+    std::map<double, LiveFrame> live = runScene([&](Simulation& simulation) {
+        check(simulation.recorder.start(path, 1), "cannot start the trajectory recording");
+        }, [&](Simulation& simulation) {
+            check(simulation.recorder.stop(), "the trajectory recording failed");
+            recordedFrames = simulation.recorder.getRecordedFrames();
+        });
+    ThreadPool pool(0, workerSpinCount);
+    TrajectoryPlayer player;
+    if (!check(player.open(path), "cannot open the recorded trajectory")) {
+        return failures();
+    }
+
+    // Played forward step by step, every recorded frame shows up once and matches the run
+    std::vector<double> recordedTimes;
+    for (const auto& [time, frame] : live) {
+        player.seek(time, pool);
+        if (player.getTime() == time) {
+            recordedTimes.push_back(time);
+        }
+        if (!matchesLive(player, live, "playing forward")) {
+            break;
+        }
+    }
+    check(recordedTimes.size() == recordedFrames && recordedFrames > 0, "the player showed " + std::to_string(recordedTimes.size()) + " frames of the " + std::to_string(recordedFrames) + " recorded");
+
+    // Seeks in random order, also between steps and outside the recording, show the last frame at or before the time
+    std::vector<double> times;
+    for (const auto& [time, frame] : live) {
+        times.insert(times.end(), { time, time + stepTime * 0.5 });
+    }
+    times.insert(times.end(), { -1.0, live.rbegin()->first + 1.0 });
+    std::shuffle(times.begin(), times.end(), std::mt19937(8));
+    for (double time : times) {
+        player.seek(time, pool);
+        auto shown = std::upper_bound(recordedTimes.begin(), recordedTimes.end(), time);
+        double expected = shown == recordedTimes.begin() ? recordedTimes.front() : *(shown - 1);
+        if (!check(player.getTime() == expected, "seeking to " + std::to_string(time) + " showed the frame at " + std::to_string(player.getTime()))) {
+            break;
+        }
+        if (!matchesLive(player, live, "seeking in random order")) {
+            break;
+        }
+    }
+
+    player.close();
+    std::remove(path.c_str());
+
+    // Event recordings of the same scene by each way of stepping it
+    const std::string eventPath = "test_recording.events";
+    struct Engine {
+        std::string name;
+        bool ballCollisions;
+        bool eventEngine;
+        bool levelOfDetail;
+    };
+    for (const Engine& engine : { Engine{ "ball collisions", true, false, false }, Engine{ "stepping", false, false, false }, Engine{ "update scheduler", false, false, true },
+        Engine{ "event engine", false, true, false } }) {
+        uint64_t keyframes = 0;
+        uint64_t spawns = 0;
+        live = runScene([&](Simulation& simulation) {
+            simulation.ballCollisions = engine.ballCollisions;
+            simulation.eventEngine = engine.eventEngine;
+            simulation.levelOfDetail = engine.levelOfDetail;
+            check(simulation.eventRecorder.start(eventPath), engine.name + ": cannot start the event recording");
+            }, [&](Simulation& simulation) {
+                check(simulation.eventRecorder.stop(), engine.name + ": the event recording failed");
+                keyframes = simulation.eventRecorder.getRecordedKeyframes();
+                spawns = simulation.eventRecorder.getRecordedSpawns();
+            });
+        // One keyframe at the start and one after the removal; the spawned balls come as spawn records
+        check(keyframes == 2 && spawns > 0, engine.name + ": recorded " + std::to_string(keyframes) + " keyframes and " + std::to_string(spawns) + " spawn records");
+        if (!check(player.open(eventPath), engine.name + ": cannot open the recorded events")) {
+            continue;
+        }
+
+        // Every step shows up exactly, played forward and in random order
+        std::vector<double> stepTimes;
+        for (const auto& [time, frame] : live) {
+            stepTimes.push_back(time);
+        }
+        std::vector<double> shuffled = stepTimes;
+        std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(9));
+        for (const std::vector<double>* order : { &stepTimes, &shuffled }) {
+            std::string name = engine.name + (order == &stepTimes ? ", playing forward" : ", seeking in random order");
+            for (double time : *order) {
+                player.seek(time, pool);
+                if (!check(player.getTime() == time, name + ": seeking to " + std::to_string(time) + " showed " + std::to_string(player.getTime()))) {
+                    break;
+                }
+                if (!matchesLive(player, live, name, eventPositionTolerance, eventVelocityTolerance)) {
+                    break;
+                }
+            }
+        }
+        player.close();
+    }
+    std::remove(eventPath.c_str());
+    return failures();
+}
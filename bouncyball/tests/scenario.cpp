@@ -0,0 +1,89 @@
+#include "testing.h"
+#include <fstream>
+#include <sstream>
+
+// Scenario test: a valid scenario file must read and apply to the scene it describes, and every invalid line must be refused with the file name and its line number, whatever comes before it.
+
+const std::string path = "test_scenario.txt";
+
+// Writes text to the scenario file and reads it, returning what readScenario printed to std::cerr
+static std::string readText(const std::string& text, Scenario& scenario, bool& read) {
+    std::ofstream(path, std::ios::binary) << text;
+    std::ostringstream errors;
+    std::streambuf* previous = std::cerr.rdbuf(errors.rdbuf());
+    read = readScenario(path, scenario);
+    std::cerr.rdbuf(previous);
+    return errors.str();
+}
+
+int main() {
+    const std::string valid =
+        "# A small scene\n"
+        "engine step\n"
+        "collisions off\r\n"
+        "step 0.01\n"
+        "\n"
+        "wall 10 10 200 10   # floor\n"
+        "wall 10 10 10 200\n"
+        "radius 2\n"
+        "color 4080C0\n"
+        "ball 100 100 45 200\n"
+        "ball 200 300 90 50\n"
+        "line 10 100 600 300 600 0 100\n"
+        "fan 20 640 360 0 360 150\n";
+    Scenario scenario;
+    bool read = false;
+    std::string errors = readText(valid, scenario, read);
+    if (check(read && errors.empty(), "a valid scenario was refused: " + errors)) {
+        check(scenario.walls.size() == 2 && scenario.balls.size() == 2 && scenario.batches.size() == 2, "the scenario does not hold what the file lists");
+        check(scenario.ballCollisions == false && scenario.stepLength == 0.01f && !scenario.levelOfDetail, "the scenario does not have the settings of the file");
+        check(scenario.balls[0].radius == 2.0f && scenario.balls[0].color == 0x4080C0FF && scenario.batches[1].radius == 2.0f, "radius and color do not carry over to the following balls");
+
+        Simulation simulation(sf::FloatRect(0, 0, SIMULATION_WIDTH, SIMULATION_HEIGHT), 0);
+        buildTestScene(simulation, 100, 10, 3);
+        applyScenario(simulation, scenario);
+        const ParticleStore& particles = simulation.particles;
+        bool same = particles.size() == 2;
+        for (size_t i = 0; same && i < particles.size(); ++i) {
+            const Ball& ball = scenario.balls[i];
+            same = particles.x[i] == ball.x && particles.y[i] == ball.y && particles.vx[i] == ball.vx && particles.vy[i] == ball.vy && particles.radius[i] == ball.radius
+                && particles.mass[i] == ball.mass && particles.color[i] == ball.color;
+        }
+        check(same, "applying the scenario did not replace the balls with its own");
+        check(simulation.walls.size() == 2 && !simulation.ballCollisions && particles.maxRadius == 2.0f, "applying the scenario did not replace the walls and settings");
+        for (int step = 0; step < 10; ++step) {
+            simulation.step(0.01f);
+        }
+        check(simulation.particles.size() == 32, "the batches of the scenario did not come alive");
+    }
+
+    // Each invalid line, after the valid scene, is reported with its line number
+    const size_t line = std::count(valid.begin(), valid.end(), '\n') + 1;
+    const std::string where = path + ":" + std::to_string(line) + ": ";
+    for (const std::string invalid : { "walls 1 2 3 4", "wall 1 2 3", "wall 1 2 3 4 5", "wall 1 2 3 x", "wall -1 2 3 4", "wall 1 2 3 5000", "ball 1 2 3",
+        "ball 10 10 -5 100", "ball 10 10 5 -100", "line 0 1 1 2 2 0 10", "fan 5 10 10 -1 90 10", "burst 5 10 10 0 10 x", "radius 0", "radius -2",
+        "radius 361", "radius 1e9", "radius x", "color 12345", "color GGGGGG", "engine fast", "broadphase tree", "collisions yes", "lod", "step 0",
+        "step -0.1" }) {
+        errors = readText(valid + invalid + "\nball 1 1 1 1\n", scenario, read);
+        check(!read, "the invalid line \"" + invalid + "\" was accepted");
+        check(errors.rfind(where, 0) == 0 && std::count(errors.begin(), errors.end(), '\n') == 1,
+            "the invalid line \"" + invalid + "\" was reported as \"" + errors + "\", not once at " + where);
+    }
+
+    // The largest ball that fits is allowed
+    errors = readText("radius 360\nball 640 360 0 0\n", scenario, read);
+    check(read && scenario.balls.size() == 1 && scenario.balls[0].radius == 360.0f, "a radius of half the display height was refused: " + errors);
+
+    // A missing file is reported, an empty one is an empty scene
+    std::remove(path.c_str());
+    std::ostringstream missing;
+    std::streambuf* previous = std::cerr.rdbuf(missing.rdbuf());
+    read = readScenario(path, scenario);
+    std::cerr.rdbuf(previous);
+    check(!read && missing.str().find(path) != std::string::npos, "a missing scenario file was not reported");
+    errors = readText("", scenario, read);
+    check(read && scenario.walls.empty() && scenario.balls.empty() && scenario.batches.empty(), "an empty scenario file was refused: " + errors);
+
+    std::remove(path.c_str());
+    return failures();
+}
@@ -0,0 +1,57 @@
+#include "testing.h"
+#include <filesystem>
+
+// Snapshot test: a scene saved part way through a run and loaded into a new simulation must go on exactly like the original, with and without ball collisions. Loading a file that is not a valid snapshot must fail and leave the simulation as it was.
+
+const float stepTime = 1.0f / 120.0f;
+const sf::FloatRect area(0, 0, SIMULATION_WIDTH, SIMULATION_HEIGHT);
+
+// Applies the settings the runs here share
+static void configure(Simulation& simulation, bool ballCollisions) {
+    simulation.ballCollisions = ballCollisions;
+    simulation.simdLevel = SimdLevel::Scalar;
+}
+
+int main() {
+    const std::string path = "test_snapshot.bbsnap";
+    for (bool ballCollisions : { false, true }) {
+        std::string name = ballCollisions ? "with ball collisions" : "without ball collisions";
+        Simulation original(area, 0);
+        configure(original, ballCollisions);
+        buildTestScene(original, 4000, 200, 5);
+        for (int step = 0; step < 50; ++step) {
+            original.step(stepTime);
+        }
+        // Removed particles are dropped on save, so remove some to cover that too
+        for (size_t i = 0; i < original.particles.size(); i += 7) {
+            original.particles.remove(i);
+        }
+        if (!check(saveSnapshot(original, path), name + ": saving failed")) {
+            continue;
+        }
+
+        Simulation restored(area, 0);
+        configure(restored, ballCollisions);
+        if (!check(loadSnapshot(restored, path), name + ": loading failed")) {
+            continue;
+        }
+        check(restored.walls.size() == original.walls.size(), name + ": the walls were not restored");
+        check(particleState(restored.particles) == particleState(original.particles), name + ": the loaded particles differ from the saved ones");
+        for (int step = 0; step < 100; ++step) {
+            original.step(stepTime);
+            restored.step(stepTime);
+        }
+        check(particleState(restored.particles) == particleState(original.particles), name + ": the restored run ended elsewhere than the original one");
+    }
+
+    // A truncated file is refused and the scene stays
+    Simulation simulation(area, 0);
+    configure(simulation, false);
+    buildTestScene(simulation, 100, 10, 6);
+    std::vector<uint32_t> before = particleState(simulation.particles);
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 4);
+    check(!loadSnapshot(simulation, path), "a truncated snapshot was loaded");
+    check(particleState(simulation.particles) == before && simulation.walls.size() == 10, "a failed load changed the scene");
+    std::remove(path.c_str());
+    return failures();
+}
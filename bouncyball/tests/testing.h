@@ -0,0 +1,61 @@
+#pragma once
+#include "simulation.h"
+#include <iostream>
+#include <cstdio>
+#include <random>
+#include <bit>
+#include <string>
+
+// Helpers shared by the core tests. Each test is an executable that ctest runs; it prints every failed check and returns how many there were, so 0 means it passed.
+
+// Number of failed checks so far
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+// Prints what failed and counts it. Returns the condition, so a test can stop when the checks after it depend on it.
+inline bool check(bool condition, const std::string& what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures();
+    }
+    return condition;
+}
+
+// Posts and applies a scene like the headless runner's generated one: wallCount short walls at random places and ballCount balls of radius 3 moving in random directions, all from seed.
+inline void buildTestScene(Simulation& simulation, size_t ballCount, size_t wallCount, unsigned int seed) {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> randomX(0.0f, static_cast<float>(SIMULATION_WIDTH));
+    std::uniform_real_distribution<float> randomY(0.0f, static_cast<float>(SIMULATION_HEIGHT));
+    std::uniform_real_distribution<float> randomAngle(0.0f, 360.0f);
+    std::uniform_real_distribution<float> randomLength(20.0f, 80.0f);
+    std::uniform_real_distribution<float> randomSpeed(50.0f, 500.0f);
+
+    std::vector<Wall> walls;
+    for (size_t i = 0; i < wallCount; ++i) {
+        sf::Vector2f start(randomX(random), randomY(random));
+        float angle = randomAngle(random) * (pi / 180.0f);
+        float length = randomLength(random);
+        walls.emplace_back(start, start + sf::Vector2f(length * std::cos(angle), length * std::sin(angle)));
+    }
+    std::vector<Ball> balls;
+    for (size_t i = 0; i < ballCount; ++i) {
+        balls.emplace_back(randomX(random) * 0.9f, randomY(random) * 0.9f + 10.0f, 3.0f, 0x6E6E6EFF, randomSpeed(random), randomAngle(random));
+    }
+    simulation.post(std::move(balls), std::move(walls));
+    simulation.applyCommands();
+}
+
+// Every value of every particle in index order, colors as their bits, so two stores compare with ==
+inline std::vector<uint32_t> particleState(const ParticleStore& particles) {
+    std::vector<uint32_t> state;
+    state.reserve(particles.size() * 7);
+    for (size_t i = 0; i < particles.size(); ++i) {
+        for (float value : { particles.x[i], particles.y[i], particles.vx[i], particles.vy[i], particles.radius[i], particles.mass[i] }) {
+            state.push_back(std::bit_cast<uint32_t>(value));
+        }
+        state.push_back(particles.color[i]);
+    }
+    return state;
+}
@@ -0,0 +1,129 @@
+#include "testing.h"
+#include <cstring>
+
+// Wall kernel test: every SIMD level must find the same wall at the same time as the scalar kernel, for single wall searches, for sweepBallBlock and for whole runs.
+// The scalar kernel does the AVX2 lane arithmetic one lane at a time, so the tolerance between them is zero: this build compiles the kernels without FMA contraction, which is the only thing that could make them round differently. The SIMD comparisons are skipped on a CPU without AVX2.
+
+static bool sameBits(float a, float b) {
+    return std::memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+int main() {
+    std::vector<SimdLevel> levels = { SimdLevel::Scalar };
+    if (bestSimdLevel() >= SimdLevel::Avx2) {
+        levels.push_back(SimdLevel::Avx2);
+    }
+    if (bestSimdLevel() >= SimdLevel::Avx512) {
+        levels.push_back(SimdLevel::Avx512);
+    }
+    if (levels.size() == 1) {
+        std::printf("no AVX2 on this CPU; only the scalar kernels were run\n");
+    }
+
+    // Short walls crowded into a small area, plus the awkward ones: zero length, horizontal and vertical
+    const sf::FloatRect area(0, 0, 400, 400);
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> coordinate(0.0f, 400.0f);
+    std::uniform_real_distribution<float> offset(-40.0f, 40.0f);
+    std::vector<Wall> walls;
+    for (int i = 0; i < 300; ++i) {
+        sf::Vector2f start(coordinate(random), coordinate(random));
+        walls.emplace_back(start, start + sf::Vector2f(offset(random), offset(random)));
+    }
+    walls.emplace_back(sf::Vector2f(200, 200), sf::Vector2f(200, 200));
+    walls.emplace_back(sf::Vector2f(50, 300), sf::Vector2f(350, 300));
+    walls.emplace_back(sf::Vector2f(300, 50), sf::Vector2f(300, 350));
+
+    std::uniform_real_distribution<float> velocity(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> radius(1.0f, 10.0f);
+    std::uniform_real_distribution<float> maxTime(0.0f, 0.1f);
+    for (BroadphaseMode mode : { BroadphaseMode::Linear, BroadphaseMode::Grid, BroadphaseMode::Bvh }) {
+        WallBroadphase broadphase(mode, wallGridCellSize);
+        broadphase.build(walls, area);
+        size_t hits = 0;
+        for (int i = 0; i < 20000; ++i) {
+            sf::Vector2f center(coordinate(random), coordinate(random));
+            sf::Vector2f ballVelocity(velocity(random), velocity(random));
+            if (i % 10 == 0) {
+                ballVelocity.y = 0; // Moving along the horizontal wall and parallel to others
+            }
+            if (i % 100 == 0) {
+                ballVelocity = sf::Vector2f(0, 0);
+            }
+            float ballRadius = radius(random);
+            float searchTime = maxTime(random);
+
+            float scalarTime = 0;
+            sf::Vector2f scalarNormal;
+            bool scalarHit = findWallHit(center, ballVelocity, ballRadius, searchTime, walls, broadphase, SimdLevel::Scalar, scalarTime, scalarNormal);
+            hits += scalarHit;
+            for (size_t level = 1; level < levels.size(); ++level) {
+                float time = 0;
+                sf::Vector2f normal;
+                bool hit = findWallHit(center, ballVelocity, ballRadius, searchTime, walls, broadphase, levels[level], time, normal);
+                std::string what = std::string(getSimdLevelName(levels[level])) + " wall search " + std::to_string(i) + " with the " + broadphase.getModeName() + " broadphase";
+                if (check(hit == scalarHit, what + " hits a wall where the scalar one does not, or the other way round") && hit) {
+                    check(sameBits(time, scalarTime) && sameBits(normal.x, scalarNormal.x) && sameBits(normal.y, scalarNormal.y), what + " finds another contact than the scalar one");
+                }
+            }
+        }
+        check(hits > 1000, std::string("too few wall hits to compare with the ") + broadphase.getModeName() + " broadphase");
+    }
+
+    // sweepBallBlock flags exactly the balls whose wall search finds a wall, including blocks shorter than wallBlockSize
+    WallBroadphase linear(BroadphaseMode::Linear, wallGridCellSize);
+    linear.build(walls, area);
+    ParticleStore particles;
+    const size_t ballCount = 4000 + 5;
+    particles.grow(ballCount, 10.0f);
+    for (size_t i = 0; i < ballCount; ++i) {
+        particles.x[i] = coordinate(random);
+        particles.y[i] = coordinate(random);
+        particles.vx[i] = i % 50 == 0 ? 0.0f : velocity(random);
+        particles.vy[i] = velocity(random);
+        particles.radius[i] = radius(random);
+    }
+    const float stepTime = 1.0f / 60.0f;
+    for (SimdLevel level : levels) {
+        for (size_t first = 0; first < ballCount; first += wallBlockSize) {
+            size_t count = std::min(wallBlockSize, ballCount - first);
+            uint32_t touching = sweepBallBlock(linear.table, particles, first, count, stepTime, level);
+            for (size_t lane = 0; lane < count; ++lane) {
+                size_t i = first + lane;
+                sf::Vector2f center(particles.x[i] + particles.radius[i], particles.y[i] + particles.radius[i]);
+                float time;
+                sf::Vector2f normal;
+                bool hit = findWallHit(center, sf::Vector2f(particles.vx[i], particles.vy[i]), particles.radius[i], stepTime, walls, linear, level, time, normal);
+                check(((touching >> lane) & 1) == static_cast<uint32_t>(hit), std::string(getSimdLevelName(level)) + " ball block disagrees with the wall search for ball " + std::to_string(i));
+            }
+        }
+    }
+
+    // Whole runs with walls end with the same positions on every level
+    for (BroadphaseMode mode : { BroadphaseMode::Linear, BroadphaseMode::Grid }) {
+        std::vector<float> scalarPositions;
+        for (SimdLevel level : levels) {
+            Simulation simulation(sf::FloatRect(0, 0, SIMULATION_WIDTH, SIMULATION_HEIGHT), 0);
+            simulation.setBroadphaseMode(mode);
+            simulation.ballCollisions = false;
+            simulation.levelOfDetail = false;
+            simulation.simdLevel = level;
+            buildTestScene(simulation, 3000, 300, 3);
+            for (int step = 0; step < 100; ++step) {
+                simulation.step(1.0f / 120.0f);
+            }
+            std::vector<float> positions;
+            for (size_t i = 0; i < simulation.particles.size(); ++i) {
+                positions.push_back(simulation.particles.x[i]);
+                positions.push_back(simulation.particles.y[i]);
+            }
+            if (level == SimdLevel::Scalar) {
+                scalarPositions = positions;
+            }
+            else {
+                check(positions == scalarPositions, std::string(getSimdLevelName(level)) + " run with the " + simulation.wallBroadphase.getModeName() + " broadphase ends elsewhere than the scalar run");
+            }
+        }
+    }
+    return failures();
+}